@@ -1,7 +1,16 @@
 #include <iostream>
 #include <regex>
 #include <set>
+#include <functional>
+#include <climits>
+#include <cstring>
+#include <tuple>
 #include "regex_lib/Regex.hpp"
+#include "regex_lib/Lexer.hpp"
+
+#ifdef DFA_JIT_SUPPORTED
+#include <unistd.h>
+#endif
 
 #define DEFAULT_SEED 0
 #define DEFAULT_MIN_NUM 1
@@ -99,6 +108,762 @@ public:
     }
 };
 
+std::string random_input(const std::set<char>& alphabet, int max_length) {
+    std::vector<char> chars(alphabet.begin(), alphabet.end());
+    chars.push_back('x');
+    std::string res;
+    int length = rand() % (max_length + 1);
+    for (int i = 0; i < length; ++i) res.push_back(chars[rand() % chars.size()]);
+    return res;
+}
+
+// the native code generated by the jit and the comb table must match exactly like the dense table,
+// and the automatons built by several threads must be the same as those built by one, laying the
+// table out for a set of samples doesn't change the matches
+bool validate(std::string name, CompileOptions options, std::set<char> alphabet, int nb_regexes, int nb_inputs) {
+    RandomRegexGenerator gen(alphabet);
+    bool ok = true;
+    for (int i = 0; i < nb_regexes; ++i) {
+        std::string regexp = gen.generate_regexp(1, 3, 3, i);
+        Regex interpreted(regexp);
+        Regex compiled(regexp, options);
+        Regex laid_out(regexp, options);
+        std::vector<std::string> samples;
+        for (int j = 0; j < 10; ++j) samples.push_back(random_input(alphabet, 50));
+        laid_out.optimize_layout(samples);
+        EngineType engine = compiled.get_engine();
+        if (!interpreted.is_valid() || (engine != EngineType::EagerDFA && engine != EngineType::PrefilterDFA)) continue;
+        if (options.jit && !compiled.is_jit_compiled()) {
+            std::cout << "jit unavailable, skipping the validation" << std::endl;
+            return true;
+        }
+        CompileStats expected = interpreted.get_compile_stats();
+        CompileStats stats = compiled.get_compile_stats();
+        if (expected.dfa_states != stats.dfa_states || expected.min_dfa_states != stats.min_dfa_states) {
+            std::cout << name << " automaton size mismatch : " << regexp << std::endl;
+            ok = false;
+        }
+        for (int j = 0; j < nb_inputs; ++j) {
+            std::string input = random_input(alphabet, 20);
+            int offset = input.empty() ? 0 : rand() % input.size();
+            int expected_match = interpreted.match(input, offset);
+            if (expected_match != compiled.match(input, offset)) {
+                std::cout << name << " mismatch : " << regexp << " on \"" << input << "\" at " << offset << std::endl;
+                ok = false;
+            }
+            if (expected_match != laid_out.match(input, offset)) {
+                std::cout << name << " mismatch after optimize_layout : " << regexp << " on \"" << input << "\" at " << offset << std::endl;
+                ok = false;
+            }
+        }
+    }
+    std::cout << name << " validation " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+// expected match lengths at offset 0, -1 when the input doesn't match
+bool check_matches(std::string name, std::string regexp, CompileOptions options, std::vector<std::pair<std::string, int>> cases) {
+    Regex reg(regexp, options);
+    bool ok = reg.is_valid();
+    if (!ok) std::cout << name << " : " << regexp << " doesn't compile : " << reg.get_error() << std::endl;
+    for (auto& [input, expected] : cases) {
+        if (!ok) break;
+        int len = reg.match(input);
+        if (len != expected) {
+            std::cout << name << " mismatch : " << regexp << " on \"" << input << "\" gives " << len << " instead of " << expected << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// repetitions nested in a factored optional used to share states with it
+bool test_regressions() {
+    bool ok = check_matches("regression", "c|caa+", CompileOptions(), {{"ca", 1}, {"caa", 3}, {"caaa", 4}, {"c", 1}});
+    ok = check_matches("regression", "ab|abcd+", CompileOptions(), {{"abd", 2}, {"abcd", 4}, {"abc", 2}}) && ok;
+    ok = check_matches("regression", "(?:ab+)?c", CompileOptions(), {{"bc", -1}, {"c", 1}, {"abbc", 4}}) && ok;
+    ok = check_matches("regression", "(?:a+)*b", CompileOptions(), {{"aab", 3}, {"b", 1}, {"a", -1}}) && ok;
+    // offsets past the end of the input match like the empty string
+    CompileOptions jit_options;
+    jit_options.jit = true;
+    CompileOptions nfa_options;
+    nfa_options.engine_hint = EngineType::NFASimulation;
+    CompileOptions bit_parallel_options;
+    bit_parallel_options.engine_hint = EngineType::BitParallel;
+    for (CompileOptions options : {CompileOptions(), jit_options, nfa_options, bit_parallel_options}) {
+        Regex nullable("[^z]*", options);
+        Regex letter("[^z]", options);
+        if (nullable.match("abc", 6) != 0 || letter.match("abc", 6) != -1 || nullable.match("abc", 3) != 0) {
+            std::cout << "regression : offset past the end with the " << engine_name(nullable.get_engine()) << " engine" << std::endl;
+            ok = false;
+        }
+    }
+    std::cout << "regression tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+// invalid regexes are reported instead of being matched as a part of the pattern
+bool test_parse_errors() {
+    bool ok = true;
+    for (std::string regexp : {"a)b", "(a))", ")", "(a", "[ab", "a{2,1}", "a{", "\\x4"}) {
+        Regex reg(regexp);
+        if (reg.is_valid() || reg.get_status() != CompileStatus::ParseError || reg.match(regexp) != -1) {
+            std::cout << "parse error expected : " << regexp << std::endl;
+            ok = false;
+        }
+    }
+    Lexer lexer({"a+", "(b"});
+    if (lexer.is_valid() || lexer.get_error().rfind("rule 1", 0) != 0) {
+        std::cout << "parse error expected in the second lexer rule" << std::endl;
+        ok = false;
+    }
+    std::cout << "parse error tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+bool test_budgets() {
+    bool ok = true;
+    CompileOptions options;
+    options.max_dfa_states = 0;
+    options.max_memory = 0;
+    RegexParser parser("(a|b)*a(a|b){12}", options);
+    parser.parse();
+    parser.optimize();
+    parser.convert_to_nda();
+    DetAutomaton automaton;
+    parser.convert_to_determistic(automaton);
+    if (automaton.minimize(0.001) || automaton.get_states_count() != 0) {
+        std::cout << "minimize should stop at the deadline" << std::endl;
+        ok = false;
+    }
+    // the deadline covers the minimization too
+    options.max_time = 1;
+    options.allow_fallback = false;
+    Regex slow(".{8000}", options);
+    if (slow.get_status() != CompileStatus::BudgetExceeded) {
+        std::cout << "compile budget expected to be exceeded" << std::endl;
+        ok = false;
+    }
+    options.allow_fallback = true;
+    Regex fallback(".{8000}", options);
+    if (!fallback.is_valid() || fallback.get_engine() == EngineType::EagerDFA || fallback.match(std::string(8000, 'a')) != 8000) {
+        std::cout << "fallback expected over the compile budget" << std::endl;
+        ok = false;
+    }
+    Lexer lexer({".{8000}", "a"}, options);
+    if (lexer.is_valid()) {
+        std::cout << "lexer compile budget expected to be exceeded" << std::endl;
+        ok = false;
+    }
+    // the workers of the parallel subset construction stop on both budgets
+    CompileOptions parallel;
+    parallel.threads = 4;
+    parallel.allow_fallback = false;
+    parallel.max_dfa_states = 100;
+    Regex too_many_states("(a|b)*a(a|b){12}", parallel);
+    parallel.max_dfa_states = 0;
+    parallel.max_memory = 0;
+    parallel.max_time = 1;
+    Regex too_slow(".{8000}", parallel);
+    if (too_many_states.get_status() != CompileStatus::BudgetExceeded || too_slow.get_status() != CompileStatus::BudgetExceeded) {
+        std::cout << "parallel compile budget expected to be exceeded" << std::endl;
+        ok = false;
+    }
+    // deep nesting is rejected before the recursive passes, long sequences are not recursive
+    CompileOptions nesting;
+    nesting.max_nesting = 100;
+    for (std::string deep : {std::string(200000, '('), "a" + std::string(200000, '*'), std::string(101, '(') + "a" + std::string(101, ')')}) {
+        Regex reg(deep, nesting);
+        Lexer lexer({"b", deep}, nesting);
+        if (reg.get_status() != CompileStatus::BudgetExceeded || lexer.get_status() != CompileStatus::BudgetExceeded) {
+            std::cout << "nesting budget expected to be exceeded" << std::endl;
+            ok = false;
+        }
+    }
+    std::string long_literal(300000, 'a');
+    nesting.max_nfa_states = 0;
+    nesting.max_memory = 0;
+    std::vector<std::pair<std::string, int>> long_regexes = {
+        {std::string(100, '(') + "a" + std::string(100, ')'), 1},
+        {long_literal, 300000},
+        {long_literal + "b|" + long_literal + "c+", 300002},
+        {"(" + long_literal + "|b)", 300000}};
+    for (auto& [regexp, expected] : long_regexes) {
+        Regex reg(regexp, nesting);
+        int res = reg.match(long_literal + "cc");
+        if (!reg.is_valid() || res != expected) {
+            std::cout << "unexpected match of length " << res << " for a long or nested regex : " << reg.get_error() << std::endl;
+            ok = false;
+        }
+    }
+    std::cout << "budget tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+bool check_tokens(std::string name, Lexer& lexer, std::string input, std::vector<std::pair<int, std::string>> expected) {
+    std::vector<Token> tokens = lexer.tokenize(input);
+    bool ok = tokens.size() == expected.size();
+    for (size_t i = 0; ok && i < tokens.size(); ++i) {
+        ok = tokens[i].rule_id == expected[i].first && tokens[i].text == expected[i].second;
+    }
+    if (!ok) {
+        std::cout << name << " : unexpected tokens for \"" << input << "\" :";
+        for (const Token& token : tokens) std::cout << " (" << token.rule_id << ", \"" << token.text << "\")";
+        std::cout << std::endl;
+    }
+    return ok;
+}
+
+bool test_lexer() {
+    bool ok = true;
+    // ties go to the first rule, unmatched bytes get the rule -1
+    Lexer keywords({"if|else", "[a-z]+", "[0-9]+", " +"});
+    ok = check_tokens("keywords", keywords, "if iffy  else 42#x", {
+        {0, "if"}, {3, " "}, {1, "iffy"}, {3, "  "}, {0, "else"}, {3, " "}, {2, "42"}, {-1, "#"}, {1, "x"}}) && ok;
+    Lexer reversed({"[a-z]+", "if|else"});
+    ok = check_tokens("reversed", reversed, "if", {{0, "if"}}) && ok;
+    // the longest match wins whatever the rule order
+    Lexer operators({"<", "<=", "<<=", "=", "=="});
+    ok = check_tokens("operators", operators, "<<=<===<", {{2, "<<="}, {1, "<="}, {4, "=="}, {0, "<"}}) && ok;
+    CompileOptions comb_options;
+    comb_options.table_layout = TableLayout::CombTable;
+    Lexer comb({"for|fort", "[a-z]+", "\\d+(\\.\\d+)?"}, comb_options);
+    ok = check_tokens("comb table", comb, "fort4.5forty3.", {{0, "fort"}, {2, "4.5"}, {1, "forty"}, {2, "3"}, {-1, "."}}) && ok;
+    // the layout only moves the rows
+    keywords.optimize_layout({"else if x 12", "iffy"});
+    ok = check_tokens("keywords laid out", keywords, "if iffy  else 42#x", {
+        {0, "if"}, {3, " "}, {1, "iffy"}, {3, "  "}, {0, "else"}, {3, " "}, {2, "42"}, {-1, "#"}, {1, "x"}}) && ok;
+    comb.optimize_layout({"3.14", "forty"});
+    ok = check_tokens("comb table laid out", comb, "fort4.5forty3.", {{0, "fort"}, {2, "4.5"}, {1, "forty"}, {2, "3"}, {-1, "."}}) && ok;
+    // the rules share a single automaton and its budget
+    CompileOptions small;
+    small.max_dfa_states = 10;
+    Lexer over_budget({"(a|b)*a(a|b){4}", "c"}, small);
+    if (over_budget.is_valid() || over_budget.get_status() != CompileStatus::BudgetExceeded || !over_budget.tokenize("ab").empty()) {
+        std::cout << "lexer budget expected to be exceeded" << std::endl;
+        ok = false;
+    }
+    std::cout << "lexer tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+std::string encode_utf8(int cp) {
+    std::string res;
+    if (cp < 0x80) return std::string(1, (char)cp);
+    int nb_bytes = cp < 0x800 ? 2 : (cp < 0x10000 ? 3 : 4);
+    res.push_back((char)((0xF00 >> nb_bytes) | (cp >> (6 * (nb_bytes - 1)))));
+    for (int i = nb_bytes - 2; i >= 0; --i) res.push_back((char)(0x80 | ((cp >> (6 * i)) & 0x3F)));
+    return res;
+}
+
+// length of the well formed UTF-8 sequence at the start of str or -1 (overlong encodings,
+// surrogates and code points above U+10FFFF are ill formed)
+int utf8_sequence_length(const std::string& str) {
+    if (str.empty()) return -1;
+    unsigned char c = str[0];
+    int nb_bytes = c < 0x80 ? 1 : (c >= 0xC2 && c <= 0xDF ? 2 : (c >= 0xE0 && c <= 0xEF ? 3 : (c >= 0xF0 && c <= 0xF4 ? 4 : -1)));
+    if (nb_bytes == -1 || (int)str.size() < nb_bytes) return -1;
+    int cp = nb_bytes == 1 ? c : c & (0x7F >> nb_bytes);
+    for (int i = 1; i < nb_bytes; ++i) {
+        if (((unsigned char)str[i] & 0xC0) != 0x80) return -1;
+        cp = (cp << 6) | (str[i] & 0x3F);
+    }
+    int min_cp = nb_bytes == 1 ? 0 : (nb_bytes == 2 ? 0x80 : (nb_bytes == 3 ? 0x800 : 0x10000));
+    if (cp < min_cp || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return -1;
+    return nb_bytes;
+}
+
+bool test_utf8() {
+    bool ok = true;
+    CompileOptions utf8;
+    utf8.utf8 = true;
+    // ranges crossing the boundaries between sequence lengths and around the surrogates
+    std::vector<std::pair<int, int>> ranges = {{0x3B1, 0x3C9}, {0x7F, 0x80}, {0x7FF, 0x800}, {0xFFFF, 0x10000},
+        {0xD7FF, 0xE000}, {0xE9, 0x17F}, {0x1F600, 0x1F64F}, {0x41, 0x10FFFF}};
+    std::vector<int> code_points = {0, 0x41, 0x7F, 0x80, 0xE8, 0xE9, 0x17F, 0x180, 0x3B0, 0x3B1, 0x3C9, 0x3CA, 0x7FF, 0x800,
+        0xD7FF, 0xE000, 0xFFFF, 0x10000, 0x1F5FF, 0x1F600, 0x1F64F, 0x1F650, 0x10FFFF};
+    for (auto [lo, hi] : ranges) {
+        for (bool negated : {false, true}) {
+            char regexp[64];
+            snprintf(regexp, sizeof(regexp), "[%s\\x{%X}-\\x{%X}]", negated ? "^" : "", lo, hi);
+            Regex reg(regexp, utf8);
+            for (int cp : code_points) {
+                std::string input = encode_utf8(cp);
+                int expected = ((lo <= cp && cp <= hi) != negated) ? (int)input.size() : -1;
+                if (reg.match(input) != expected) {
+                    std::cout << "utf8 mismatch : " << regexp << " on U+" << std::hex << cp << std::dec << std::endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    // '.' and negated sets only match well formed sequences, like the reference decoder
+    Regex dot(".", utf8);
+    Regex negated("[^a]", utf8);
+    std::vector<unsigned char> bytes = {0x00, 0x41, 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC1, 0xC2, 0xDF, 0xE0, 0xED, 0xEF, 0xF0, 0xF4, 0xF5, 0xFF};
+    srand(DEFAULT_SEED);
+    for (int i = 0; i < 20000; ++i) {
+        std::string input;
+        int length = 1 + rand() % 4;
+        for (int j = 0; j < length; ++j) input.push_back((char)bytes[rand() % bytes.size()]);
+        int expected = utf8_sequence_length(input);
+        if (dot.match(input) != expected || negated.match(input) != (input[0] == 'a' ? -1 : expected)) {
+            std::cout << "utf8 mismatch on the sequence";
+            for (unsigned char c : input) std::cout << " " << std::hex << (int)c << std::dec;
+            std::cout << std::endl;
+            ok = false;
+        }
+    }
+    // without the option '.' is a byte, sets of non ASCII characters are still code points
+    Regex byte_dot(".");
+    Regex greek("[α-ω]+");
+    if (byte_dot.match("\xFF") != 1 || byte_dot.match("é") != 1 || greek.match("αβγd") != 6 || greek.match("\xCE") != -1) {
+        std::cout << "utf8 mismatch without the utf8 option" << std::endl;
+        ok = false;
+    }
+    std::cout << "utf8 tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+bool test_case_folding() {
+    bool ok = true;
+    CompileOptions ascii;
+    ascii.case_folding = CaseFolding::AsciiCaseInsensitive;
+    CompileOptions unicode;
+    unicode.case_folding = CaseFolding::CaseInsensitive;
+    CompileOptions unicode_utf8 = unicode;
+    unicode_utf8.utf8 = true;
+    ok = check_matches("ascii folding", "hello|[a-c]+x", ascii, {{"HeLLo", 5}, {"aBcX", 4}, {"é", -1}}) && ok;
+    ok = check_matches("ascii folding", "[^a-c]", ascii, {{"A", -1}, {"b", -1}, {"C", -1}, {"d", 1}, {"D", 1}}) && ok;
+    ok = check_matches("ascii folding", "é", ascii, {{"é", 2}, {"É", -1}}) && ok;
+    ok = check_matches("unicode folding", "[α-ω]+|привет", unicode, {{"ΑβΓ", 6}, {"ПРИвет", 12}}) && ok;
+    ok = check_matches("unicode folding", "[à-þ]ő", unicode, {{"Àő", 4}, {"éŐ", 4}, {"×ő", -1}}) && ok;
+    ok = check_matches("unicode folding", "[^a]", unicode, {{"A", -1}, {"b", 1}}) && ok;
+    ok = check_matches("unicode folding", "[^αé]", unicode_utf8, {{"Α", -1}, {"É", -1}, {"β", 2}, {"e", 1}}) && ok;
+    // a lowercase regex matches a string with case folding like it matches the string in lowercase
+    std::set<char> alphabet = {'a', 'b', 'c'};
+    RandomRegexGenerator gen(alphabet);
+    for (int i = 0; i < 100; ++i) {
+        std::string regexp = gen.generate_regexp(1, 3, 3, i);
+        Regex folded(regexp, ascii);
+        Regex lowercase(regexp);
+        if (!lowercase.is_valid()) continue;
+        for (int j = 0; j < 50; ++j) {
+            std::string input = random_input({'a', 'b', 'c', 'A', 'B', 'C'}, 12);
+            std::string lower = input;
+            for (char& c : lower) c = (char)tolower((unsigned char)c);
+            if (folded.match(input) != lowercase.match(lower)) {
+                std::cout << "case folding mismatch : " << regexp << " on \"" << input << "\"" << std::endl;
+                ok = false;
+            }
+        }
+    }
+    std::cout << "case folding tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+// the literal engine (teddy for up to 32 literals, aho-corasick above) must find the same
+// matches as the deterministic automaton, inputs are long enough for the 16 byte chunks
+bool test_literal_set() {
+    bool ok = true;
+    CompileOptions automaton_options;
+    automaton_options.max_literals = 0;
+    srand(DEFAULT_SEED);
+    for (int i = 0; i < 100; ++i) {
+        int nb_literals = 1 + rand() % 48;
+        std::set<std::string> literals;
+        while ((int)literals.size() < nb_literals) {
+            std::string literal;
+            int length = 1 + rand() % 6;
+            for (int j = 0; j < length; ++j) literal.push_back("abcd"[rand() % 4]);
+            literals.insert(literal);
+        }
+        std::string regexp;
+        for (const std::string& literal : literals) regexp += (regexp.empty() ? "" : "|") + literal;
+        Regex literal_set(regexp);
+        Regex automaton(regexp, automaton_options);
+        if (literal_set.get_engine() != EngineType::LiteralSet || automaton.get_engine() == EngineType::LiteralSet) {
+            std::cout << "literal set engine expected for " << regexp << std::endl;
+            ok = false;
+            continue;
+        }
+        for (int j = 0; j < 50; ++j) {
+            std::string input;
+            int length = rand() % 80;
+            for (int k = 0; k < length; ++k) input.push_back("abcdx"[rand() % 5]);
+            int offset = input.empty() ? 0 : rand() % input.size();
+            if (literal_set.search(input, offset) != automaton.search(input, offset) || literal_set.match(input, offset) != automaton.match(input, offset)) {
+                std::cout << "literal set mismatch : " << regexp << " on \"" << input << "\" at " << offset << std::endl;
+                ok = false;
+            }
+        }
+    }
+    std::cout << "literal set tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+bool check_plan(std::string regexp, CompileOptions options, EngineType engine, std::string reason) {
+    Regex reg(regexp, options);
+    EnginePlan plan = reg.get_plan();
+    if (reg.get_engine() != engine || plan.engine != engine || plan.reason.find(reason) == std::string::npos) {
+        std::cout << "planner : " << regexp << " gives " << engine_name(reg.get_engine()) << " (" << plan.reason << ") instead of "
+            << engine_name(engine) << " (" << reason << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool test_planner() {
+    bool ok = true;
+    CompileOptions options;
+    ok = check_plan("if|else|while", options, EngineType::LiteralSet, "alternation of 3 literals") && ok;
+    ok = check_plan("hello\\d+", options, EngineType::PrefilterDFA, "literal prefix") && ok;
+    ok = check_plan("\\d+hello", options, EngineType::EagerDFA, "no literal prefix") && ok;
+    // case folding disables the literal engines
+    CompileOptions folded;
+    folded.case_folding = CaseFolding::AsciiCaseInsensitive;
+    ok = check_plan("if|else|while", folded, EngineType::EagerDFA, "no literal prefix") && ok;
+    // over budget the bit masks are used up to 64 positions, then the simulation
+    CompileOptions small;
+    small.max_dfa_states = 100;
+    ok = check_plan("(a|b)*a(a|b){12}", small, EngineType::BitParallel, "over budget, 14 positions") && ok;
+    ok = check_plan("(ab|cd)*a(ab|cd){40}", small, EngineType::NFASimulation, "over budget") && ok;
+    Regex fallback("(a|b)*a(a|b){12}", small);
+    if (fallback.get_plan().dfa_states != -1 || fallback.match("ba" + std::string(12, 'b')) != 14) {
+        std::cout << "planner : fallback over budget doesn't match" << std::endl;
+        ok = false;
+    }
+    // hints are followed when the regex allows them, otherwise the planner keeps its own choice
+    CompileOptions hinted;
+    hinted.engine_hint = EngineType::NFASimulation;
+    ok = check_plan("hello\\d+", hinted, EngineType::NFASimulation, "engine hint") && ok;
+    hinted.engine_hint = EngineType::EagerDFA;
+    ok = check_plan("hello\\d+", hinted, EngineType::EagerDFA, "engine hint") && ok;
+    hinted.engine_hint = EngineType::LiteralSet;
+    ok = check_plan("a+b", hinted, EngineType::EagerDFA, ", the hinted engine doesn't apply") && ok;
+    hinted.engine_hint = EngineType::BitParallel;
+    ok = check_plan("(ab|cd)*a(ab|cd){40}", hinted, EngineType::EagerDFA, ", the hinted engine doesn't apply") && ok;
+    // match statistics are only collected by the deterministic automaton
+    Regex literals("if|else|while");
+    Regex automaton("\\d+hello");
+    if (literals.enable_match_stats() || !automaton.enable_match_stats() || automaton.match("12hello") != 7 || automaton.get_match_stats().bytes_scanned != 7) {
+        std::cout << "planner : unexpected match statistics" << std::endl;
+        ok = false;
+    }
+    std::cout << "planner tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+// the rows of the automaton are released once the table is built and read back from it when
+// the automaton changes
+bool test_table_release() {
+    bool ok = true;
+    RegexParser parser("(ab|cd)*e|a[^b]+", CompileOptions());
+    parser.parse();
+    parser.optimize();
+    parser.convert_to_nda();
+    DetAutomaton automaton;
+    parser.convert_to_determistic(automaton);
+    automaton.minimize();
+    int nb_states = automaton.get_states_count();
+    std::vector<std::pair<std::string, int>> cases = {{"abcde", 5}, {"ab", -1}, {"axyz", 4}, {"e", 1}};
+    for (TableLayout layout : {TableLayout::CombTable, TableLayout::DenseTable, TableLayout::CombTable}) {
+        for (auto& [input, expected] : cases) {
+            if (automaton.match(input) != expected) {
+                std::cout << "table release mismatch on \"" << input << "\"" << std::endl;
+                ok = false;
+            }
+        }
+        if (automaton.get_states_count() != nb_states) {
+            std::cout << "table release changes the number of states" << std::endl;
+            ok = false;
+        }
+        automaton.set_table_layout(layout);
+    }
+    automaton.add_transition(automaton.get_start_state(), 'z', automaton.get_start_state());
+    if (automaton.match("zzabe") != 5) {
+        std::cout << "table release mismatch after adding a transition" << std::endl;
+        ok = false;
+    }
+    std::cout << "table release tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+// automatons with more than 65535 row offsets need 32 bits table entries
+bool test_wide_table() {
+    bool ok = true;
+    CompileOptions options;
+    options.max_dfa_states = 0;
+    RegexParser parser("(a|b)*a(a|b){14}", options);
+    parser.parse();
+    parser.optimize();
+    parser.convert_to_nda();
+    DetAutomaton automaton;
+    parser.convert_to_determistic(automaton);
+    automaton.minimize();
+    if (automaton.get_table_entry_size() != 4) {
+        std::cout << "wide table : " << automaton.get_table_rows_count() << " rows use " << automaton.get_table_entry_size() << " bytes entries" << std::endl;
+        ok = false;
+    }
+    std::set<char> alphabet = {'a', 'b'};
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 200; ++i) inputs.push_back(random_input(alphabet, 40));
+    std::vector<int> expected;
+    for (const std::string& input : inputs) expected.push_back(parser.nd_automaton.match(input));
+    auto check = [&](std::string name, std::function<int(const std::string&)> match) {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (match(inputs[i]) != expected[i]) {
+                std::cout << "wide table " << name << " mismatch on \"" << inputs[i] << "\"" << std::endl;
+                ok = false;
+                return;
+            }
+        }
+    };
+    check("dense", [&](const std::string& input) { return automaton.match(input); });
+    DfaJit jit;
+    if (jit.compile(automaton)) {
+        check("jit", [&](const std::string& input) {
+            const unsigned char* begin = (const unsigned char*)input.data();
+            return jit.longest_match(begin, begin + input.size());
+        });
+    }
+    automaton.optimize_layout({inputs.begin(), inputs.begin() + 20});
+    check("laid out", [&](const std::string& input) { return automaton.match(input); });
+    automaton.set_table_layout(TableLayout::CombTable);
+    check("comb", [&](const std::string& input) { return automaton.match(input); });
+    std::cout << "wide table tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+// the scan stops at the dead row and at final rows instead of reading the rest of the input
+bool test_early_stop() {
+    bool ok = true;
+    // 2 and 3 can't reach the end state 1, whose transitions only lead to them
+    DetAutomaton automaton;
+    automaton.add_transition(0, 'a', 1);
+    automaton.add_transition(0, 'b', 2);
+    automaton.add_transition(2, 'c', 3);
+    automaton.add_transition(1, 'x', 3);
+    automaton.set_start_state(0);
+    automaton.add_end_state(1);
+    int nb_final = 0;
+    for (int row = 1; row < automaton.get_table_rows_count(); ++row) {
+        if (automaton.is_table_final(row)) nb_final += automaton.is_table_accepting(row) ? 1 : 100;
+    }
+    if (automaton.get_dead_states_count() != 2 || automaton.get_table_rows_count() != 3 || nb_final != 1 || automaton.is_table_final(automaton.get_table_start())) {
+        std::cout << "early stop : wrong dead or final rows" << std::endl;
+        ok = false;
+    }
+    automaton.minimize();
+    if (automaton.get_dead_states_count() != 2 || automaton.match("ax") != 1 || automaton.match("bc") != -1) {
+        std::cout << "early stop : wrong dead states after minimizing" << std::endl;
+        ok = false;
+    }
+    // bytes read by the table walker
+    std::vector<std::tuple<std::string, std::string, int, long long>> scans = {
+        {"ab[^z]*", "a" + std::string(1 << 20, 'q'), -1, 1},
+        {"a(b|c)d", "abd" + std::string(1 << 20, 'd'), 3, 3},
+        {"ab[^z]*", "ab" + std::string(1 << 20, 'q'), (1 << 20) + 2, (1 << 20) + 2}};
+    for (auto& [regexp, input, expected, scanned] : scans) {
+        Regex reg(regexp);
+        reg.enable_match_stats();
+        if (reg.match(input) != expected || reg.get_match_stats().bytes_scanned != scanned) {
+            std::cout << "early stop : " << regexp << " scans " << reg.get_match_stats().bytes_scanned << " bytes instead of " << scanned << std::endl;
+            ok = false;
+        }
+    }
+#ifdef DFA_JIT_SUPPORTED
+    // the jit code reaches the final and dead rows before the protected page that follows the
+    // match, reading it would crash
+    long page_size = sysconf(_SC_PAGESIZE);
+    unsigned char* pages = (unsigned char*)mmap(nullptr, 2 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages != MAP_FAILED && mprotect(pages + page_size, page_size, PROT_NONE) == 0) {
+        unsigned char* guard = pages + page_size;
+        for (auto [regexp, input, expected] : std::vector<std::tuple<std::string, std::string, int>>{{"a(b|c)d", "abd", 3}, {"abc", "abx", -1}}) {
+            RegexParser parser(regexp, CompileOptions());
+            parser.parse();
+            parser.optimize();
+            parser.convert_to_nda();
+            DetAutomaton dfa;
+            parser.convert_to_determistic(dfa);
+            dfa.minimize();
+            DfaJit jit;
+            if (!jit.compile(dfa)) break;
+            std::memcpy(guard - input.size(), input.data(), input.size());
+            if (jit.longest_match(guard - input.size(), guard + page_size) != expected) {
+                std::cout << "early stop : jit mismatch for " << regexp << std::endl;
+                ok = false;
+            }
+        }
+    }
+    if (pages != MAP_FAILED) munmap(pages, 2 * page_size);
+#endif
+    std::cout << "early stop tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
+// syntax tree of the regexes generated to test the capture groups : 'c' a character, '.' a
+// concatenation, '|' an alternation, '(' a capture group, '*' '+' '?' and '{' repetitions
+struct GroupTestNode {
+    char type;
+    char c = 0;
+    int group = 0;
+    int min = 0;
+    int max = 0;
+    std::vector<GroupTestNode> operands;
+};
+
+// the operands of the repetitions can't match the empty string, the reference below would
+// otherwise have to decide how an empty iteration sets the groups
+GroupTestNode random_group_node(int depth, bool nullable) {
+    int kind = depth >= 3 ? 0 : rand() % (nullable ? 9 : 5);
+    GroupTestNode n{"c.|(+*?{{"[kind]};
+    if (kind == 0) n.c = "abc"[rand() % 3];
+    if (kind == 1) n.operands = {random_group_node(depth + 1, false), random_group_node(depth + 1, true)};
+    if (kind == 2) n.operands = {random_group_node(depth + 1, false), random_group_node(depth + 1, false)};
+    if (kind == 3) n.operands = {random_group_node(depth + 1, nullable)};
+    if (kind >= 4) n.operands = {random_group_node(depth + 1, false)};
+    if (kind >= 7) {
+        n.min = rand() % (kind == 7 ? 3 : 2);
+        n.max = kind == 7 ? n.min : n.min + 1 + rand() % 2;
+    }
+    return n;
+}
+
+// numbers the groups in the order of their parenthesis
+std::string group_test_regexp(GroupTestNode& n, int& nb_groups) {
+    std::string res;
+    switch (n.type)
+    {
+    case 'c': return std::string(1, n.c);
+    case '.':
+        for (GroupTestNode& operand : n.operands) {
+            std::string sub = group_test_regexp(operand, nb_groups);
+            res += operand.type == '|' ? "(?:" + sub + ")" : sub;
+        }
+        return res;
+    case '|':
+        res = group_test_regexp(n.operands[0], nb_groups);
+        return res + "|" + group_test_regexp(n.operands[1], nb_groups);
+    case '(':
+        n.group = ++nb_groups;
+        return "(" + group_test_regexp(n.operands[0], nb_groups) + ")";
+    default:
+        {
+            GroupTestNode& operand = n.operands[0];
+            std::string sub = group_test_regexp(operand, nb_groups);
+            if (operand.type != 'c' && operand.type != '(') sub = "(?:" + sub + ")";
+            if (n.type != '{') return sub + n.type;
+            if (n.min == n.max) return sub + "{" + std::to_string(n.min) + "}";
+            return sub + "{" + std::to_string(n.min) + "," + std::to_string(n.max) + "}";
+        }
+    }
+}
+
+// backtracking reference : the matches are enumerated in priority order (first alternative,
+// longest repetition) and a group keeps its last value, continuation is called on every match
+void group_test_match(const GroupTestNode& n, const std::string& str, int pos, std::vector<int>& slots, const std::function<void(int)>& continuation) {
+    switch (n.type)
+    {
+    case 'c':
+        if (pos < (int)str.size() && str[pos] == n.c) continuation(pos + 1);
+        break;
+    case '.':
+        group_test_match(n.operands[0], str, pos, slots, [&](int p) { group_test_match(n.operands[1], str, p, slots, continuation); });
+        break;
+    case '|':
+        for (const GroupTestNode& operand : n.operands) group_test_match(operand, str, pos, slots, continuation);
+        break;
+    case '(':
+        {
+            int start = slots[2 * n.group];
+            slots[2 * n.group] = pos;
+            group_test_match(n.operands[0], str, pos, slots, [&](int p) {
+                int end = slots[2 * n.group + 1];
+                slots[2 * n.group + 1] = p;
+                continuation(p);
+                slots[2 * n.group + 1] = end;
+            });
+            slots[2 * n.group] = start;
+        }
+        break;
+    default:
+        {
+            int min = n.type == '+' ? 1 : (n.type == '{' ? n.min : 0);
+            int max = n.type == '?' ? 1 : (n.type == '{' ? n.max : INT_MAX);
+            std::function<void(int, int)> repeat = [&](int i, int p) {
+                if (i < max) group_test_match(n.operands[0], str, p, slots, [&](int q) { repeat(i + 1, q); });
+                if (i >= min) continuation(p);
+            };
+            repeat(0, pos);
+        }
+    }
+}
+
+bool check_groups(std::string regexp, std::string input, std::vector<std::pair<int, int>> expected) {
+    Regex reg(regexp);
+    std::vector<std::pair<int, int>> groups;
+    int len = reg.match_groups(input, groups);
+    if (len != reg.match(input) || groups != expected) {
+        std::cout << "groups mismatch : " << regexp << " on \"" << input << "\" :";
+        for (auto [start, end] : groups) std::cout << " (" << start << ", " << end << ")";
+        std::cout << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool test_groups() {
+    bool ok = check_groups("(\\d+)-(\\d+)", "12-345", {{0, 6}, {0, 2}, {3, 6}});
+    // the first alternative wins among the submatches of the longest match, whether the
+    // alternatives share a prefix or not
+    ok = check_groups("(a|ab)(b?)", "ab", {{0, 2}, {0, 1}, {1, 2}}) && ok;
+    ok = check_groups("(a|(a)b)(b?)", "ab", {{0, 2}, {0, 1}, {-1, -1}, {1, 2}}) && ok;
+    ok = check_groups("(x|xy)(y?)z", "xyz", {{0, 3}, {0, 1}, {1, 2}}) && ok;
+    ok = check_groups("(a)|(b)", "b", {{0, 1}, {-1, -1}, {0, 1}}) && ok;
+    ok = check_groups("(a)b", "ac", {{-1, -1}, {-1, -1}}) && ok;
+    // groups keep the value of the last iteration that went through them
+    ok = check_groups("((a)(b))+", "abab", {{0, 4}, {2, 4}, {2, 3}, {3, 4}}) && ok;
+    ok = check_groups("(a|b){3}", "abb", {{0, 3}, {2, 3}}) && ok;
+    ok = check_groups("((a)|b){2,3}c", "abc", {{0, 3}, {1, 2}, {0, 1}}) && ok;
+    ok = check_groups("(a){0}b", "ab", {{-1, -1}, {-1, -1}}) && ok;
+    srand(DEFAULT_SEED);
+    for (int i = 0; i < 1000; ++i) {
+        GroupTestNode root = random_group_node(0, true);
+        int nb_groups = 0;
+        std::string regexp = group_test_regexp(root, nb_groups);
+        Regex reg(regexp);
+        std::vector<std::pair<int, int>> groups;
+        for (int j = 0; j < 20; ++j) {
+            std::string input;
+            int length = rand() % 8;
+            for (int k = 0; k < length; ++k) input.push_back("abc"[rand() % 3]);
+            std::vector<int> slots(2 * (nb_groups + 1), -1);
+            std::vector<int> best;
+            int best_len = -1;
+            group_test_match(root, input, 0, slots, [&](int p) {
+                if (p <= best_len) return;
+                best_len = p;
+                best = slots;
+            });
+            std::vector<std::pair<int, int>> expected(nb_groups + 1, {-1, -1});
+            if (best_len != -1) {
+                expected[0] = {0, best_len};
+                for (int g = 1; g <= nb_groups; ++g) {
+                    if (best[2 * g] != -1 && best[2 * g + 1] != -1) expected[g] = {best[2 * g], best[2 * g + 1]};
+                }
+            }
+            int len = reg.match_groups(input, groups);
+            if (len != best_len || groups != expected) {
+                std::cout << "groups mismatch : " << regexp << " on \"" << input << "\"" << std::endl;
+                ok = false;
+            }
+        }
+    }
+    std::cout << "capture group tests " << (ok ? "passed" : "failed") << std::endl;
+    return ok;
+}
+
 int main()
 {
 	std::set<char> alphabet = {'a', 'b', 'c'};
@@ -107,6 +872,27 @@ int main()
     std::cout << regexp << std::endl;
     Regex reg(regexp);
     reg.print_automaton();
+    CompileOptions jit_options;
+    jit_options.jit = true;
+    CompileOptions comb_options;
+    comb_options.table_layout = TableLayout::CombTable;
+    CompileOptions parallel_options;
+    parallel_options.threads = 4;
+    bool ok = test_regressions();
+    ok = test_parse_errors() && ok;
+    ok = test_budgets() && ok;
+    ok = test_lexer() && ok;
+    ok = test_utf8() && ok;
+    ok = test_case_folding() && ok;
+    ok = test_literal_set() && ok;
+    ok = test_planner() && ok;
+    ok = test_groups() && ok;
+    ok = test_table_release() && ok;
+    ok = test_early_stop() && ok;
+    ok = test_wide_table() && ok;
+    ok = validate("jit", jit_options, alphabet, 200, 100) && ok;
+    ok = validate("comb table", comb_options, alphabet, 200, 100) && ok;
+    ok = validate("parallel", parallel_options, alphabet, 200, 100) && ok;
     std::cin.get();
-	return 0;
+	return ok ? 0 : 1;
 }
\ No newline at end of file
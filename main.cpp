@@ -22,6 +22,10 @@ int main(int argc, char const *argv[])
     std::cout << "the regular expression : " << regexp << std::endl;
     std::cout << "the input string : " << input << std::endl;
     Regex reg(regexp);
+    if (!reg.is_valid()) {
+        std::cout << reg.get_error() << std::endl;
+        return -1;
+    }
     std::cout << "matched string length : " << reg.match(input) << std::endl; 
     std::cin.get();
     return 0;
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <vector>
+#include <map>
+
+#include "Node.hpp"
+
+// rewrites the syntax tree produced by the parser into a smaller equivalent tree before
+// the thompson construction : nested pipes and concatenations are flattened, alternatives
+// sharing a literal prefix are factored into a trie, single characters alternatives are
+// merged into a character set and nested repetitions are collapsed
+class AstOptimizer {
+private:
+    // factoring reorders the alternatives and merging repetitions changes how many times the
+    // operands are repeated, both change the submatches picked by the capture groups even
+    // when the groups are outside of the rewritten nodes, so regexes with groups skip them
+    bool has_groups = false;
+public:
+    explicit AstOptimizer(bool t_has_groups = false) : has_groups(t_has_groups) { }
+
+    Node* optimize(Node* n) {
+        for (Node*& operand : n->operands) operand = optimize(operand);
+        return rewrite(n);
+    }
+
+private:
+    Node* rewrite(Node* n) {
+        switch (n->type)
+        {
+        case NodeType::Pipe:
+            {
+                if (has_groups) {
+                    // alternatives of a single byte all give the same submatches
+                    CharRanges chars;
+                    for (Node* alternative : flatten(n, NodeType::Pipe)) {
+                        if (alternative->type == NodeType::Char) {
+                            unsigned char c = std::get<char>(alternative->val);
+                            chars.push_back({c, c});
+                        } else if (alternative->type == NodeType::CharSelect) {
+                            auto& ranges = std::get<CharRanges>(alternative->val);
+                            chars.insert(chars.end(), ranges.begin(), ranges.end());
+                        } else {
+                            return new_node(NodeType::Pipe, flatten(n, NodeType::Pipe));
+                        }
+                    }
+                    return make_char_select(chars);
+                }
+                std::vector<std::vector<Node*>> alternatives;
+                for (Node* alternative : flatten(n, NodeType::Pipe)) alternatives.push_back(flatten(alternative, NodeType::Concat));
+                Node* res = factor(alternatives);
+                return res != nullptr ? res : n;
+            }
+        case NodeType::Concat:
+            return make_concat(flatten(n, NodeType::Concat));
+        case NodeType::StarRep:
+        case NodeType::PlusRep:
+        case NodeType::OptRep:
+            return has_groups ? n : merge_repetitions(n);
+        case NodeType::ValRep:
+            if (std::get<int>(n->val) == 1) return n->operands[0];
+            return n;
+        case NodeType::BoundedRep:
+            {
+                auto [num1, num2] = std::get<std::pair<int, int>>(n->val);
+                if (num1 == 1 && num2 == 1) return n->operands[0];
+                if (num1 == 0 && num2 == 1) return new_node(NodeType::OptRep, {n->operands[0]});
+                return n;
+            }
+        case NodeType::CharSelect:
+            return make_char_select(std::get<CharRanges>(n->val));
+        case NodeType::CodePointSelect:
+            return make_code_point_select(std::get<CharRanges>(n->val));
+        default:
+            return n;
+        }
+    }
+
+    Node* make_char_select(CharRanges ranges) {
+        ranges = normalize_ranges(ranges);
+        if (ranges.size() == 1 && ranges[0].first == ranges[0].second) return new Node(NodeType::Char, (char)ranges[0].first);
+        return new Node(NodeType::CharSelect, ranges);
+    }
+
+    // ASCII code points are encoded as themselves
+    Node* make_code_point_select(CharRanges ranges) {
+        ranges = normalize_ranges(ranges);
+        if (!ranges.empty() && ranges.back().second < 0x80) return make_char_select(ranges);
+        return new Node(NodeType::CodePointSelect, ranges);
+    }
+
+    Node* new_node(NodeType type, std::vector<Node*> operands) {
+        Node* n = new Node(type);
+        n->operands = operands;
+        return n;
+    }
+
+    std::vector<Node*> flatten(Node* n, NodeType type) {
+        if (n->type != type) return {n};
+        std::vector<Node*> res;
+        for (Node* operand : n->operands) {
+            for (Node* m : flatten(operand, type)) res.push_back(m);
+        }
+        return res;
+    }
+
+    // an empty sequence is the empty string, represented by nullptr
+    Node* make_concat(std::vector<Node*> sequence) {
+        if (sequence.empty()) return nullptr;
+        if (sequence.size() == 1) return sequence[0];
+        return new_node(NodeType::Concat, sequence);
+    }
+
+    // (a*)* (a+)* (a?)* (a*)+ (a*)? ... are all reduced to a single repetition
+    Node* merge_repetitions(Node* n) {
+        Node* operand = n->operands[0];
+        bool is_rep = operand->type == NodeType::StarRep || operand->type == NodeType::PlusRep || operand->type == NodeType::OptRep;
+        if (!is_rep) return n;
+        if (operand->type == n->type) return operand;
+        operand->type = NodeType::StarRep;
+        return operand;
+    }
+
+    // builds a trie out of alternatives starting with the same literal, returns nullptr
+    // when every alternative is the empty string
+    Node* factor(std::vector<std::vector<Node*>> alternatives) {
+        bool has_empty = false;
+        std::vector<char> prefixes;
+        std::map<char, std::vector<std::vector<Node*>>> groups;
+        std::vector<Node*> branches;
+        std::vector<int> others;
+        for (int i = 0; i < (int)alternatives.size(); ++i) {
+            auto& alternative = alternatives[i];
+            if (alternative.empty()) {
+                has_empty = true;
+            } else if (alternative[0]->type == NodeType::Char) {
+                char c = std::get<char>(alternative[0]->val);
+                if (groups.find(c) == groups.end()) prefixes.push_back(c);
+                groups[c].push_back(std::vector<Node*>(alternative.begin() + 1, alternative.end()));
+            } else {
+                others.push_back(i);
+            }
+        }
+
+        CharRanges merged_chars;
+        CharRanges merged_code_points;
+        for (char c : prefixes) {
+            auto& rests = groups[c];
+            if (rests.size() == 1 && rests[0].empty()) {
+                merged_chars.push_back({(unsigned char)c, (unsigned char)c});
+                continue;
+            }
+            // the literal prefix shared by all the rests is taken at once, the recursion only
+            // goes as deep as the trie branches
+            std::vector<Node*> common = {new Node(NodeType::Char, c)};
+            size_t len = common_prefix_length(rests);
+            common.insert(common.end(), rests[0].begin(), rests[0].begin() + len);
+            for (auto& rest : rests) rest.erase(rest.begin(), rest.begin() + len);
+            Node* rest = rests.size() == 1 ? make_concat(rests[0]) : factor(rests);
+            Node* first = make_concat(common);
+            branches.push_back(rest == nullptr ? first : make_concat(prepend(first, rest)));
+        }
+        for (int i : others) {
+            Node* alternative = make_concat(alternatives[i]);
+            if (alternative->type == NodeType::CharSelect) {
+                auto& ranges = std::get<CharRanges>(alternative->val);
+                merged_chars.insert(merged_chars.end(), ranges.begin(), ranges.end());
+            } else if (alternative->type == NodeType::CodePointSelect) {
+                auto& ranges = std::get<CharRanges>(alternative->val);
+                merged_code_points.insert(merged_code_points.end(), ranges.begin(), ranges.end());
+            } else {
+                branches.push_back(alternative);
+            }
+        }
+        if (!merged_chars.empty()) branches.push_back(make_char_select(merged_chars));
+        if (!merged_code_points.empty()) branches.push_back(make_code_point_select(merged_code_points));
+
+        if (branches.empty()) return nullptr;
+        Node* res = branches.size() == 1 ? branches[0] : new_node(NodeType::Pipe, branches);
+        if (has_empty) res = merge_repetitions(new_node(NodeType::OptRep, {res}));
+        return res;
+    }
+
+    // number of literals that all the sequences start with
+    size_t common_prefix_length(const std::vector<std::vector<Node*>>& sequences) {
+        for (size_t len = 0;; ++len) {
+            for (auto& sequence : sequences) {
+                if (len >= sequence.size() || sequence[len]->type != NodeType::Char) return len;
+                if (std::get<char>(sequence[len]->val) != std::get<char>(sequences[0][len]->val)) return len;
+            }
+        }
+    }
+
+    std::vector<Node*> prepend(Node* first, Node* rest) {
+        std::vector<Node*> res = flatten(first, NodeType::Concat);
+        for (Node* n : flatten(rest, NodeType::Concat)) res.push_back(n);
+        return res;
+    }
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <set>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+#include "NDetAutomaton.hpp"
+
+// matches small regexes without building the deterministic automaton : the positions of the
+// glushkov automaton (the labeled transitions of the non deterministic automaton) are the
+// bits of a 64 bit word and a step is the union of the follow sets of the active positions,
+// read 8 positions at a time from precomputed tables, filtered by the positions of the byte
+class BitParallelMatcher {
+private:
+    static const int MAX_POSITIONS = 64;
+
+    int nb_positions = -1;
+    int nb_tables = 0;
+    bool nullable = false;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    uint64_t char_masks[256];
+    // follow_tables[i * 256 + b] is the union of the follow sets of the positions 8i + k
+    // for the bits k set in b
+    std::vector<uint64_t> follow_tables;
+
+public:
+    BitParallelMatcher() { }
+
+    // returns false when the automaton has more than 64 positions
+    bool build(NDetAutomaton& nd_automaton) {
+        nb_positions = -1;
+        std::vector<std::pair<CharSet, int>> positions;
+        std::map<int, uint64_t> leaving;
+        for (auto& [s1, edges] : nd_automaton.get_transition_table()) {
+            for (auto& [label, s2] : edges) {
+                if ((int)positions.size() == MAX_POSITIONS) return false;
+                leaving[s1] |= 1ULL << positions.size();
+                positions.push_back({label, s2});
+            }
+        }
+        std::set<int> end_states = nd_automaton.get_end_states();
+        // positions reachable right after a state and whether the state can end the match
+        auto follow = [&](int s, bool& accepting) {
+            uint64_t res = 0;
+            accepting = false;
+            for (int t : nd_automaton.epsilon_closure({s})) {
+                auto it = leaving.find(t);
+                if (it != leaving.end()) res |= it->second;
+                if (end_states.find(t) != end_states.end()) accepting = true;
+            }
+            return res;
+        };
+
+        nb_positions = (int)positions.size();
+        nb_tables = (nb_positions + 7) / 8;
+        first = follow(nd_automaton.get_start_state(), nullable);
+        last = 0;
+        std::vector<uint64_t> follow_sets(nb_positions);
+        for (int c = 0; c < 256; ++c) char_masks[c] = 0;
+        for (int p = 0; p < nb_positions; ++p) {
+            bool accepting;
+            follow_sets[p] = follow(positions[p].second, accepting);
+            if (accepting) last |= 1ULL << p;
+            for (int c = 0; c < 256; ++c) {
+                if (positions[p].first[c]) char_masks[c] |= 1ULL << p;
+            }
+        }
+        follow_tables.assign((size_t)nb_tables * 256, 0);
+        for (int i = 0; i < nb_tables; ++i) {
+            for (int b = 1; b < 256; ++b) {
+                // the table of a byte is the table of the byte without its lowest bit plus one follow set
+                int k = 0;
+                while (!(b & (1 << k))) k++;
+                uint64_t res = follow_tables[i * 256 + (b & (b - 1))];
+                if (8 * i + k < nb_positions) res |= follow_sets[8 * i + k];
+                follow_tables[i * 256 + b] = res;
+            }
+        }
+        return true;
+    }
+
+    bool is_built() {
+        return nb_positions != -1;
+    }
+
+    int get_positions_count() {
+        return nb_positions;
+    }
+
+    // length of the longest prefix of [begin, end) matched by the regex or -1
+    int longest_match(const unsigned char* begin, const unsigned char* end) {
+        int matched = nullable ? 0 : -1;
+        const unsigned char* p = begin;
+        if (p == end) return matched;
+        uint64_t active = first & char_masks[*p];
+        while (active != 0) {
+            p++;
+            if (active & last) matched = (int)(p - begin);
+            if (p == end) break;
+            uint64_t next = 0;
+            for (int i = 0; i < nb_tables; ++i) next |= follow_tables[i * 256 + ((active >> (8 * i)) & 0xFF)];
+            active = next & char_masks[*p];
+        }
+        return matched;
+    }
+
+    // an offset past the end of the string matches like the empty string
+    int match(const std::string& str, int offset = 0) {
+        const unsigned char* begin = (const unsigned char*)str.data();
+        return longest_match(begin + std::min(offset, (int)str.size()), begin + str.size());
+    }
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "Commun.hpp"
+#include "Node.hpp"
+#include "CompileOptions.hpp"
+
+// last code point with a case variant in simple_case_fold
+#define MAX_CASED_CODE_POINT 0x4FF
+
+// simple one to one case folding of ASCII, Latin-1, Latin Extended-A, Greek and Cyrillic,
+// returns the lower case variant of a code point or the code point itself
+inline int simple_case_fold(int cp) {
+    if (cp >= 'A' && cp <= 'Z') return cp + 0x20;
+    if (cp < 0xC0 || cp > MAX_CASED_CODE_POINT) return cp;
+    if (cp <= 0xDE) return cp != 0xD7 ? cp + 0x20 : cp;
+    if (cp == 0x178) return 0xFF;
+    // pairs of upper and lower case letters
+    if ((cp >= 0x100 && cp <= 0x12F) || (cp >= 0x132 && cp <= 0x137) || (cp >= 0x14A && cp <= 0x177)) return cp | 1;
+    if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E)) return cp % 2 == 1 ? cp + 1 : cp;
+    if (cp == 0x386) return 0x3AC;
+    if (cp >= 0x388 && cp <= 0x38A) return cp + 0x25;
+    if (cp == 0x38C) return 0x3CC;
+    if (cp == 0x38E || cp == 0x38F) return cp + 0x3F;
+    if ((cp >= 0x391 && cp <= 0x3A1) || (cp >= 0x3A3 && cp <= 0x3AB)) return cp + 0x20;
+    if (cp == 0x3C2) return 0x3C3;
+    if (cp >= 0x400 && cp <= 0x40F) return cp + 0x50;
+    if (cp >= 0x410 && cp <= 0x42F) return cp + 0x20;
+    if ((cp >= 0x460 && cp <= 0x481) || (cp >= 0x48A && cp <= 0x4BF) || (cp >= 0x4D0 && cp <= 0x4FF)) return cp | 1;
+    if (cp == 0x4C0) return 0x4CF;
+    if (cp >= 0x4C1 && cp <= 0x4CE) return cp % 2 == 1 ? cp + 1 : cp;
+    return cp;
+}
+
+// adds the other case of the ASCII letters of the set, other bytes are left as is
+inline CharSet fold_ascii_bytes(CharSet chars) {
+    for (int c = 'A'; c <= 'Z'; ++c) {
+        if (chars[c] || chars[c + 0x20]) chars.set(c).set(c + 0x20);
+    }
+    return chars;
+}
+
+// adds every case variant of the code points of the (normalized) ranges, only the
+// ASCII letters are folded with AsciiCaseInsensitive
+inline CharRanges fold_code_points(const CharRanges& ranges, CaseFolding folding) {
+    if (folding == CaseFolding::CaseSensitive) return ranges;
+    int max_cp = folding == CaseFolding::AsciiCaseInsensitive ? 0x7F : MAX_CASED_CODE_POINT;
+    std::vector<bool> folded(max_cp + 1, false);
+    for (auto [lo, hi] : ranges) {
+        for (int cp = lo; cp <= std::min(hi, max_cp); ++cp) folded[simple_case_fold(cp)] = true;
+    }
+    CharRanges res = ranges;
+    for (int cp = 0; cp <= max_cp; ++cp) {
+        if (folded[simple_case_fold(cp)]) res.push_back({cp, cp});
+    }
+    return normalize_ranges(res);
+}
@@ -1,13 +1,55 @@
 #pragma once
 
+#include <bitset>
+#include <string>
+
 #define is_char(x) (((x) >= 'a' && (x) <= 'z') || ((x) >= 'A' && (x) <= 'Z') || (x) == ' ')
 #define is_num(x) ((x) >= '0' && (x) <= '9')
 #define EPSILON '\0'
-#define MATCH_OTHERS '.'
+
+// tokens of the lexical parser, literals are code points and the other tokens are above MAX_CODE_POINT
+#define END_OF_INPUT '\0'
+#define DIGIT 0x110001
+#define ALPHA 0x110002
+#define ALPHANUM 0x110003
+// flags set on escaped literals and on raw bytes written as \xHH
+#define ESCAPED 0x200000
+#define RAW_BYTE 0x400000
+
+// approximate sizes in bytes of the std containers used by the automatons, used for the memory budget
+#define STATE_SET_OVERHEAD 48
+#define STATE_SET_ENTRY_SIZE 40
+// the rows of the deterministic automaton have one int per byte class
+#define TRANSITION_SIZE 4
 
 int generate_uid() {
     static int id = 0;
     int res = id;
     id++;
     return res;
+}
+
+// set of bytes labeling a transition
+using CharSet = std::bitset<256>;
+
+inline std::string byte_to_string(int c) {
+    if (c > ' ' && c < 127) return std::string(1, (char)c);
+    return "\\x" + std::string(1, "0123456789abcdef"[c >> 4]) + "0123456789abcdef"[c & 15];
+}
+
+// prints a set of bytes as ranges, [0-9a-z] for example
+inline std::string charset_to_string(const CharSet& chars) {
+    if (chars.count() == 1) {
+        for (int c = 0; c < 256; ++c) if (chars[c]) return byte_to_string(c);
+    }
+    std::string res = "[";
+    for (int c = 0; c < 256; ++c) {
+        if (!chars[c]) continue;
+        int last = c;
+        while (last + 1 < 256 && chars[last + 1]) last++;
+        res += byte_to_string(c);
+        if (last > c) res += "-" + byte_to_string(last);
+        c = last;
+    }
+    return res + "]";
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+
+// PrefilterDFA is the deterministic automaton with a search that skips to the occurrences of
+// the literal prefix of the regex, BitParallel simulates small regexes with bit masks,
+// Automatic only appears in CompileOptions::engine_hint
+enum EngineType {EagerDFA, NFASimulation, LiteralSet, PrefilterDFA, BitParallel, Automatic};
+
+enum CompileStatus {CompileOk, ParseError, BudgetExceeded};
+
+// AsciiCaseInsensitive only folds ASCII letters, CaseInsensitive also folds the letters
+// of Latin-1, Latin Extended-A, Greek and Cyrillic
+enum CaseFolding {CaseSensitive, AsciiCaseInsensitive, CaseInsensitive};
+
+// DenseTable stores every transition of every state, CombTable only the transitions that
+// differ from the default one of their state and is much smaller for large automatons
+enum TableLayout {DenseTable, CombTable};
+
+// limits applied while compiling a regular expression, a limit of 0 disables the check
+struct CompileOptions {
+    int max_nfa_states = 100000;
+    int max_dfa_states = 10000;
+    // rough estimate of the memory used by the automatons and the subset construction
+    long long max_memory = 64LL * 1024 * 1024;
+    double max_time = 0; // ms
+    // groups and repetitions nested deeper are rejected, the syntax tree is processed recursively
+    int max_nesting = 1000;
+    // when the deterministic automaton goes over budget the regex is matched by
+    // simulating the non deterministic automaton instead of failing to compile
+    bool allow_fallback = true;
+    // '.', negated sets and \xHH match whole UTF-8 encoded code points instead of single bytes,
+    // sets containing non ASCII characters are matched as code points in both modes
+    bool utf8 = false;
+    // folding is applied to the transitions of the automatons, matching costs the same
+    CaseFolding case_folding = CaseFolding::CaseSensitive;
+    // alternations of up to max_literals plain strings are matched by a dedicated literal
+    // engine instead of the automatons, 0 disables it
+    int max_literals = 100000;
+    // compiles the deterministic automaton to native code (x86-64 only), other architectures
+    // and automatons too large to compile keep the table walker
+    bool jit = false;
+    TableLayout table_layout = TableLayout::DenseTable;
+    // threads used by the subset construction, 0 uses every hardware thread
+    int threads = 1;
+    // forces an engine instead of letting the planner pick one, the planner still falls back
+    // to its own choice when the regex can't use the engine (see EnginePlan::reason)
+    EngineType engine_hint = EngineType::Automatic;
+};
+
+class RegexError : public std::runtime_error {
+public:
+    RegexError(CompileStatus t_status, std::string message) : std::runtime_error(message), status(t_status) { }
+
+    CompileStatus status;
+};
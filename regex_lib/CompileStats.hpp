@@ -0,0 +1,57 @@
+#pragma once
+
+#include <iostream>
+#include <chrono>
+
+// counters collected while compiling a regular expression, times are in milliseconds
+struct CompileStats {
+    int ast_nodes = 0;
+    int optimized_ast_nodes = 0;
+    int nfa_states = 0;
+    int nfa_edges = 0;
+    int epsilon_edges = 0;
+    int dfa_states = 0;
+    int min_dfa_states = 0;
+    int dead_states = 0;
+    int peak_subset_size = 0;
+    int closure_calls = 0;
+    size_t table_bytes = 0;
+
+    double parse_time = 0;
+    double optimize_time = 0;
+    double thompson_time = 0;
+    double subset_time = 0;
+    double minimize_time = 0;
+
+    using clock = std::chrono::steady_clock;
+
+    static double elapsed_ms(clock::time_point start, clock::time_point end) {
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    void print() {
+        std::cout << "compile statistics " << std::endl;
+        std::cout << "ast nodes : " << ast_nodes << " (optimized : " << optimized_ast_nodes << ")" << std::endl;
+        std::cout << "nfa states : " << nfa_states << " (edges : " << nfa_edges << ", epsilon edges : " << epsilon_edges << ")" << std::endl;
+        std::cout << "dfa states : " << dfa_states << " (minimized : " << min_dfa_states << ", dead : " << dead_states << ")" << std::endl;
+        std::cout << "peak subset size : " << peak_subset_size << std::endl;
+        std::cout << "closure calls : " << closure_calls << std::endl;
+        std::cout << "table : " << table_bytes << " bytes" << std::endl;
+        std::cout << "parse : " << parse_time << " ms, optimize : " << optimize_time << " ms, thompson : " << thompson_time << " ms, ";
+        std::cout << "subset construction : " << subset_time << " ms, minimize : " << minimize_time << " ms" << std::endl;
+    }
+};
+
+// counters updated by the matcher, only collected when enabled on the Regex
+struct MatchStats {
+    long long matches = 0;
+    long long bytes_scanned = 0;
+    long long states_visited = 0;
+
+    void print() {
+        std::cout << "match statistics " << std::endl;
+        std::cout << "matches : " << matches << std::endl;
+        std::cout << "bytes scanned : " << bytes_scanned << std::endl;
+        std::cout << "states visited : " << states_visited << std::endl;
+    }
+};
@@ -10,14 +10,295 @@
 #include <tuple>
 #include <fstream>
 #include <sstream>
+#include <cstdint>
+#include <algorithm>
 
 #include "Commun.hpp"
+#include "CompileStats.hpp"
+#include "CompileOptions.hpp"
 
 class DetAutomaton {
 private:
-    std::map<int, std::map<char, int>> transition_table;
+    // the bytes are split into classes that no transition tells apart, byte_classes maps a
+    // byte to its class and every state has a row with the next state of each class, -1
+    // without transition. a transition whose label cuts a class splits it
+    std::map<int, std::vector<int>> transition_table;
+    std::vector<int> byte_classes;
+    int nb_classes = 1;
     int start_state = -1;
     std::set<int> end_states;
+    std::map<int, int> end_tags;
+
+    // dense representation used by the scan loop, rebuilt after every modification.
+    // each state is a row of nb_classes entries holding the offset of the next state's row
+    // for each byte class, the classes being merged first when they go to the same states
+    // from every state. rows are laid out as : the dead row 0 (no transition), the non
+    // accepting states, the accepting states then the final states, accepting states that
+    // can't be extended, so every check is a single compare. states from which no accepting
+    // state can be reached have no row and their transitions go to the dead row.
+    // entries are 16 bits wide when the offsets fit, rows are in depth first order from the
+    // start state, hottest paths first after optimize_layout()
+    bool table_dirty = true;
+    TableLayout table_layout = TableLayout::DenseTable;
+    int nb_rows = 0;
+    int entry_size = 4;
+    std::vector<uint16_t> table16;
+    std::vector<uint32_t> table32;
+    // states are referred to by the offset of their row, row * nb_classes in the dense table
+    // and row in the comb table
+    int row_stride = 1;
+    int table_start = 0;
+    int accept_start = 0;
+    int final_start = 0;
+    int nb_dead_states = 0;
+    // states equivalent to the dead state removed by minimize()
+    int dead_states_removed = 0;
+    // tags of the accepting rows, offsets being multiples of row_stride the row of an offset
+    // is offset * row_reciprocal >> 32 with row_reciprocal = ceil(2^32 / row_stride)
+    std::vector<int> row_tags;
+    uint64_t row_reciprocal = 0;
+    // once the table is built the rows, end states and tags above are released and restored
+    // from the table when they are needed again. the states of the rows 1 to nb_rows - 1
+    // come first in state_ids, followed by the dead states which are restored without
+    // transitions
+    std::vector<int> state_ids;
+    bool rows_released = false;
+
+    // comb table : the non default entries of every row are stored in a shared array at
+    // comb_base[row] + byte class, an entry belongs to the row when its check is the row and
+    // the other classes go to comb_default[row], the most frequent target of the row
+    struct CombEntry {
+        int next;
+        int check;
+    };
+    std::vector<CombEntry> comb;
+    std::vector<int> comb_base;
+    std::vector<int> comb_default;
+    // visits of every state counted by optimize_layout()
+    std::map<int, long long> state_visits;
+
+    // walks the table from the start row, returns the length of the longest accepted prefix
+    // or -1 with the row offset of its state in last_state and the bytes read in scanned
+    template <typename T>
+    int scan(const std::vector<T>& table, const unsigned char* begin, const unsigned char* end, int& last_state, int& scanned) {
+        const T* rows = table.data();
+        const int* classes = byte_classes.data();
+        const int accept = accept_start;
+        const int final_row = final_start;
+        const unsigned char* p = begin;
+        int curr = table_start;
+        int last_matched = -1;
+        while (true) {
+            if (curr >= accept) {
+                last_matched = (int)(p - begin);
+                last_state = curr;
+                if (curr >= final_row) break;
+            }
+            if (p == end) break;
+            int next = rows[curr + classes[*p]];
+            if (next == 0) break;
+            curr = next;
+            p++;
+        }
+        scanned = (int)(p - begin);
+        return last_matched;
+    }
+
+    int scan_comb(const unsigned char* begin, const unsigned char* end, int& last_state, int& scanned) {
+        const CombEntry* entries = comb.data();
+        const int* base = comb_base.data();
+        const int* deflt = comb_default.data();
+        const int* classes = byte_classes.data();
+        const int accept = accept_start;
+        const int final_row = final_start;
+        const unsigned char* p = begin;
+        int curr = table_start;
+        int last_matched = -1;
+        while (true) {
+            if (curr >= accept) {
+                last_matched = (int)(p - begin);
+                last_state = curr;
+                if (curr >= final_row) break;
+            }
+            if (p == end) break;
+            const CombEntry& entry = entries[base[curr] + classes[*p]];
+            int next = entry.check == curr ? entry.next : deflt[curr];
+            if (next == 0) break;
+            curr = next;
+            p++;
+        }
+        scanned = (int)(p - begin);
+        return last_matched;
+    }
+
+    void release_rows() {
+        transition_table.clear();
+        end_states.clear();
+        end_tags.clear();
+        rows_released = true;
+    }
+
+    void restore_rows() {
+        if (!rows_released) return;
+        rows_released = false;
+        for (int r = 1; r < nb_rows; ++r) {
+            int s = state_ids[r - 1];
+            std::vector<int>& targets = row(s);
+            for (int k = 0; k < nb_classes; ++k) {
+                int next = next_row(r, k);
+                if (next != 0) targets[k] = state_ids[next - 1];
+            }
+            if (r * row_stride >= accept_start) {
+                end_states.insert(s);
+                end_tags[s] = row_tags[r - accept_start / row_stride];
+            }
+        }
+        for (int i = nb_rows - 1; i < (int)state_ids.size(); ++i) row(state_ids[i]);
+    }
+
+    // row reached from a row with a byte class, 0 when there is no transition
+    int next_row(int row, int byte_class) {
+        if (table_layout == TableLayout::CombTable) {
+            const CombEntry& entry = comb[comb_base[row] + byte_class];
+            return entry.check == row ? entry.next : comb_default[row];
+        }
+        int i = row * nb_classes + byte_class;
+        int offset = entry_size == 2 ? table16[i] : (int)table32[i];
+        return offset / nb_classes;
+    }
+
+    // row of a state, created without transitions
+    std::vector<int>& row(int s) {
+        auto it = transition_table.find(s);
+        if (it != transition_table.end()) return it->second;
+        return transition_table.emplace(s, std::vector<int>(nb_classes, -1)).first->second;
+    }
+
+    // splits the classes that have bytes both inside and outside of chars, the new class
+    // gets a copy of the transitions of the class it comes from
+    void split_classes(const CharSet& chars) {
+        std::vector<int> inside(nb_classes, 0);
+        std::vector<int> sizes(nb_classes, 0);
+        for (int c = 0; c < 256; ++c) {
+            sizes[byte_classes[c]]++;
+            if (chars[c]) inside[byte_classes[c]]++;
+        }
+        std::vector<int> split(nb_classes, -1);
+        int nb_split = nb_classes;
+        for (int k = 0; k < nb_classes; ++k) {
+            if (inside[k] > 0 && inside[k] < sizes[k]) split[k] = nb_split++;
+        }
+        if (nb_split == nb_classes) return;
+        for (int c = 0; c < 256; ++c) {
+            if (chars[c] && split[byte_classes[c]] != -1) byte_classes[c] = split[byte_classes[c]];
+        }
+        for (auto& [s, targets] : transition_table) {
+            targets.resize(nb_split);
+            for (int k = 0; k < nb_classes; ++k) {
+                if (split[k] != -1) targets[split[k]] = targets[k];
+            }
+        }
+        nb_classes = nb_split;
+    }
+
+    // merges the classes that go to the same state from every state
+    void merge_classes() {
+        std::vector<int> merged(nb_classes, 0);
+        int nb_merged = 1;
+        for (auto& [s, targets] : transition_table) {
+            std::map<std::pair<int, int>, int> refined;
+            for (int k = 0; k < nb_classes; ++k) {
+                auto inserted = refined.insert({{merged[k], targets[k]}, (int)refined.size()});
+                merged[k] = inserted.first->second;
+            }
+            nb_merged = (int)refined.size();
+        }
+        if (nb_merged == nb_classes) return;
+        for (int c = 0; c < 256; ++c) byte_classes[c] = merged[byte_classes[c]];
+        for (auto& [s, targets] : transition_table) {
+            std::vector<int> res(nb_merged);
+            for (int k = 0; k < nb_classes; ++k) res[merged[k]] = targets[k];
+            targets = res;
+        }
+        nb_classes = nb_merged;
+    }
+
+    // row displacement : rows with the most entries are placed first, each one at the
+    // lowest base where its entries only fall on free slots
+    void build_comb(const std::vector<std::vector<std::pair<int, int>>>& row_entries) {
+        comb.clear();
+        comb_base.assign(nb_rows, 0);
+        comb_default.assign(nb_rows, 0);
+        std::vector<std::vector<int>> columns(nb_rows);
+        std::vector<std::vector<int>> targets(nb_rows);
+        for (int row = 0; row < nb_rows; ++row) {
+            // classes without an entry go to the dead row
+            std::map<int, int> counts;
+            counts[0] = nb_classes - (int)row_entries[row].size();
+            for (auto [c, next] : row_entries[row]) counts[next]++;
+            int best = 0;
+            for (auto [next, count] : counts) {
+                if (count > counts[best]) best = next;
+            }
+            comb_default[row] = best;
+            std::vector<int> row_targets(nb_classes, 0);
+            for (auto [c, next] : row_entries[row]) row_targets[c] = next;
+            for (int c = 0; c < nb_classes; ++c) {
+                if (row_targets[c] == best) continue;
+                columns[row].push_back(c);
+                targets[row].push_back(row_targets[c]);
+            }
+        }
+        std::vector<int> placement(nb_rows);
+        for (int row = 0; row < nb_rows; ++row) placement[row] = row;
+        std::stable_sort(placement.begin(), placement.end(), [&](int a, int b) {
+            return columns[a].size() > columns[b].size();
+        });
+        // next_free[i] leads to the first free slot at or after i (path halving)
+        std::vector<int> next_free;
+        auto find_free = [&](int i) {
+            while (i < (int)next_free.size() && next_free[i] != i) {
+                if (next_free[i] < (int)next_free.size()) next_free[i] = next_free[next_free[i]];
+                i = next_free[i];
+            }
+            return i;
+        };
+        // slots go from free to used only, so a row can start its search where the last row
+        // with the same columns was placed
+        std::map<std::vector<int>, int> last_slot;
+        for (int row : placement) {
+            if (columns[row].empty()) continue;
+            const std::vector<int>& cols = columns[row];
+            // the first column of the row is tried on every free slot
+            auto it = last_slot.find(cols);
+            int slot = find_free(it != last_slot.end() ? it->second : cols[0]);
+            while (true) {
+                int base = slot - cols[0];
+                bool fits = true;
+                for (int c : cols) {
+                    if (base + c < (int)comb.size() && comb[base + c].check != -1) {
+                        fits = false;
+                        break;
+                    }
+                }
+                if (fits) break;
+                slot = find_free(slot + 1);
+            }
+            last_slot[cols] = slot;
+            int base = slot - cols[0];
+            comb_base[row] = base;
+            if ((int)comb.size() < base + nb_classes) {
+                for (int i = (int)comb.size(); i < base + nb_classes; ++i) next_free.push_back(i);
+                comb.resize(base + nb_classes, {0, -1});
+            }
+            for (int i = 0; i < (int)cols.size(); ++i) {
+                comb[base + cols[i]] = {targets[row][i], row};
+                next_free[base + cols[i]] = base + cols[i] + 1;
+            }
+        }
+        // every row reads up to base + nb_classes - 1
+        comb.resize(std::max((int)comb.size(), nb_classes), {0, -1});
+    }
 public:
     explicit DetAutomaton() {
         this->clear();
@@ -45,16 +326,26 @@ public:
         nb_end_states = std::stoi(line);
         for (int i = 0; i < nb_end_states; ++i) {
             std::getline(in, line);
-            this->end_states.insert(std::stoi(line));
+            this->add_end_state(std::stoi(line));
         }
         
-        // read transitions
+        // read transitions, "s1 lo hi s2" for the bytes lo to hi or "s1 c s2" for a single byte
         while (std::getline(in, line)) {
             std::istringstream iss(line);
-            int s1, s2;
-            char c;
-            iss >> s1 >> c >> s2;
-            this->add_transition(s1, c, s2);
+            std::vector<int> values;
+            int value;
+            while (iss >> value) values.push_back(value);
+            bool valid = (values.size() == 3 || values.size() == 4) && iss.eof();
+            int lo = valid ? values[1] : -1;
+            int hi = values.size() == 4 ? values[2] : lo;
+            if (!valid || lo < 0 || hi > 255 || lo > hi) {
+                std::cout << "error : invalid transition \"" << line << "\" in file " << file_name << std::endl;
+                this->clear();
+                return false;
+            }
+            CharSet chars;
+            for (int c = lo; c <= hi; ++c) chars.set(c);
+            this->add_transition(values[0], chars, values.back());
         }
         return true;
     }
@@ -62,101 +353,565 @@ public:
     bool save(std::string file_name) {
         std::ofstream out(file_name);
         if (!out.is_open()) return false;
+        bool released = rows_released;
+        restore_rows();
         out << "Derteministic automaton\n";
         out << start_state << "\n";
         out << end_states.size() << "\n";
         for (int i : end_states) out << i << "\n";
-        for (auto& [s1, c_s2] : this->transition_table) {
-            for (auto& [c, s2] : c_s2) {
-                out << s1 << " " << c << " " << s2 << "\n";
+        // one line per range of bytes going to the same state
+        for (auto& [s1, targets] : this->transition_table) {
+            for (int lo = 0; lo < 256; ) {
+                int s2 = targets[byte_classes[lo]];
+                int hi = lo;
+                while (hi + 1 < 256 && targets[byte_classes[hi + 1]] == s2) hi++;
+                if (s2 != -1) out << s1 << " " << lo << " " << hi << " " << s2 << "\n";
+                lo = hi + 1;
             }
         }
         out.close();
+        if (released) release_rows();
         return true;
     }
 
-    int match(std::string str, int offset = 0) {
-        if (start_state == -1) return -1;
-        int curr = start_state;
-        int str_pos = offset;
-        int last_matched = -1;
-        while (str_pos < str.size()) {
-            int next_state = -1;
-            if (end_states.find(curr) != end_states.end()) last_matched = str_pos;
-            if (this->transition_table[curr].find(str[str_pos]) != this->transition_table[curr].end()) next_state = this->transition_table[curr][str[str_pos]];
-            else if (this->transition_table[curr].find(MATCH_OTHERS) != this->transition_table[curr].end()) next_state = this->transition_table[curr][MATCH_OTHERS];
-            else break;
-            str_pos++;
-            curr = next_state;
+    // an offset past the end of the string matches like the empty string
+    int match(const std::string& str, int offset = 0, MatchStats* stats = nullptr) {
+        const unsigned char* begin = (const unsigned char*)str.data() + std::min(offset, (int)str.size());
+        return longest_match(begin, (const unsigned char*)str.data() + str.size(), nullptr, stats);
+    }
+
+    // length of the longest prefix of [begin, end) accepted by the automaton or -1, the tag
+    // of the accepting state is stored in tag
+    int longest_match(const unsigned char* begin, const unsigned char* end, int* tag = nullptr, MatchStats* stats = nullptr) {
+        if (table_dirty) build_table();
+        if (table_start == 0) {
+            if (tag != nullptr) *tag = -1;
+            return -1;
+        }
+        int last_state = 0;
+        int scanned = 0;
+        int matched;
+        if (table_layout == TableLayout::CombTable) matched = scan_comb(begin, end, last_state, scanned);
+        else if (entry_size == 2) matched = scan(table16, begin, end, last_state, scanned);
+        else matched = scan(table32, begin, end, last_state, scanned);
+        if (stats != nullptr) {
+            stats->matches++;
+            stats->bytes_scanned += scanned;
+            stats->states_visited += scanned + 1;
+        }
+        if (tag != nullptr) *tag = matched != -1 ? row_tags[((uint64_t)(last_state - accept_start) * row_reciprocal) >> 32] : -1;
+        return matched;
+    }
+
+    // bytes going to the same state from every state share a class
+    void build_table() {
+        restore_rows();
+        table_dirty = false;
+        table16.clear();
+        table32.clear();
+        comb.clear();
+        comb_base.clear();
+        comb_default.clear();
+        row_tags.clear();
+        nb_rows = 0;
+        table_start = 0;
+        accept_start = 0;
+        final_start = 0;
+        nb_dead_states = 0;
+        state_ids.clear();
+        if (start_state == -1) return;
+        row(start_state);
+        merge_classes();
+
+        std::set<int> live = live_states();
+        nb_dead_states = (int)(transition_table.size() - live.size());
+        // an accepting state is final when none of its transitions leads to a live state
+        auto is_final = [&](int s) {
+            for (int s2 : transition_table[s]) {
+                if (s2 != -1 && live.find(s2) != live.end()) return false;
+            }
+            return true;
+        };
+        std::vector<int> order = layout_order();
+        std::vector<int> accepting, finals, rows;
+        for (int s : order) {
+            if (live.find(s) == live.end()) continue;
+            if (end_states.find(s) == end_states.end()) rows.push_back(s);
+            else if (is_final(s)) finals.push_back(s);
+            else accepting.push_back(s);
         }
-        if (end_states.find(curr) == end_states.end()) return last_matched != -1 ? last_matched - offset : -1;
-        return str_pos - offset;
+        int nb_non_accepting = (int)rows.size();
+        rows.insert(rows.end(), accepting.begin(), accepting.end());
+        rows.insert(rows.end(), finals.begin(), finals.end());
+        for (int i = nb_non_accepting; i < (int)rows.size(); ++i) row_tags.push_back(end_tags[rows[i]]);
+        nb_rows = (int)rows.size() + 1;
+        row_stride = table_layout == TableLayout::CombTable ? 1 : nb_classes;
+        // dead states keep the offset 0
+        std::map<int, int> offsets;
+        for (auto& [s, targets] : transition_table) offsets[s] = 0;
+        for (int i = 0; i < (int)rows.size(); ++i) offsets[rows[i]] = (i + 1) * row_stride;
+        accept_start = (nb_non_accepting + 1) * row_stride;
+        final_start = (nb_non_accepting + (int)accepting.size() + 1) * row_stride;
+        row_reciprocal = ((1ULL << 32) + row_stride - 1) / row_stride;
+        table_start = offsets[start_state];
+        state_ids = rows;
+        for (auto& [s, offset] : offsets) {
+            if (offset == 0) state_ids.push_back(s);
+        }
+
+        if (table_layout == TableLayout::CombTable) {
+            std::vector<std::vector<std::pair<int, int>>> row_entries(nb_rows);
+            for (auto& [s, targets] : transition_table) {
+                if (offsets[s] == 0) continue;
+                std::vector<std::pair<int, int>>& entries = row_entries[offsets[s]];
+                for (int k = 0; k < nb_classes; ++k) {
+                    if (targets[k] != -1 && offsets[targets[k]] != 0) entries.push_back({k, offsets[targets[k]]});
+                }
+            }
+            build_comb(row_entries);
+            release_rows();
+            return;
+        }
+        std::vector<int> entries((size_t)nb_rows * nb_classes, 0);
+        for (auto& [s, targets] : transition_table) {
+            int offset = offsets[s];
+            if (offset == 0) continue;
+            for (int k = 0; k < nb_classes; ++k) {
+                if (targets[k] != -1) entries[offset + k] = offsets[targets[k]];
+            }
+        }
+        // accept_start is compared with the entries and must fit as well
+        long long max_offset = std::max((long long)nb_rows * nb_classes, (long long)accept_start);
+        entry_size = max_offset <= 0xFFFF ? 2 : 4;
+        if (entry_size == 2) table16.assign(entries.begin(), entries.end());
+        else table32.assign(entries.begin(), entries.end());
+        release_rows();
+    }
+
+    // states from which an accepting state can be reached
+    std::set<int> live_states() {
+        restore_rows();
+        std::map<int, std::vector<int>> predecessors;
+        for (auto& [s, targets] : transition_table) {
+            for (int s2 : targets) {
+                if (s2 != -1) predecessors[s2].push_back(s);
+            }
+        }
+        std::set<int> live;
+        std::vector<int> to_visit(end_states.begin(), end_states.end());
+        while (!to_visit.empty()) {
+            int s = to_visit.back();
+            to_visit.pop_back();
+            if (!live.insert(s).second) continue;
+            for (int s2 : predecessors[s]) {
+                if (live.find(s2) == live.end()) to_visit.push_back(s2);
+            }
+        }
+        return live;
+    }
+
+    // states in depth first order from the start state so that the states along a path are
+    // close to each other, after optimize_layout() the most visited successors come first
+    // and the visited states are placed before the others
+    std::vector<int> layout_order() {
+        restore_rows();
+        auto visits = [this](int s) {
+            auto it = state_visits.find(s);
+            return it != state_visits.end() ? it->second : 0;
+        };
+        // successors are listed in the order of the lowest byte of their class
+        std::vector<int> classes_order;
+        std::vector<bool> listed(nb_classes, false);
+        for (int c = 0; c < 256; ++c) {
+            if (listed[byte_classes[c]]) continue;
+            listed[byte_classes[c]] = true;
+            classes_order.push_back(byte_classes[c]);
+        }
+        std::vector<int> order;
+        std::set<int> seen;
+        std::vector<int> to_visit = {start_state};
+        while (!to_visit.empty()) {
+            int s = to_visit.back();
+            to_visit.pop_back();
+            if (!seen.insert(s).second) continue;
+            order.push_back(s);
+            std::vector<int> successors;
+            const std::vector<int>& targets = transition_table[s];
+            for (int k : classes_order) {
+                if (targets[k] != -1 && seen.find(targets[k]) == seen.end()) successors.push_back(targets[k]);
+            }
+            std::stable_sort(successors.begin(), successors.end(), [&](int a, int b) { return visits(a) > visits(b); });
+            to_visit.insert(to_visit.end(), successors.rbegin(), successors.rend());
+        }
+        // states that can't be reached from the start state still get a row
+        for (auto& [s, targets] : transition_table) {
+            if (seen.insert(s).second) order.push_back(s);
+        }
+        if (!state_visits.empty()) {
+            std::stable_partition(order.begin(), order.end(), [&](int s) { return visits(s) > 0; });
+        }
+        return order;
+    }
+
+    // counts the states visited while matching the samples at every position and lays the
+    // table out so that the most visited states are contiguous
+    void optimize_layout(const std::vector<std::string>& samples) {
+        restore_rows();
+        state_visits.clear();
+        if (start_state == -1) return;
+        for (const std::string& sample : samples) {
+            for (size_t offset = 0; offset < sample.size(); ++offset) {
+                int curr = start_state;
+                state_visits[curr]++;
+                for (size_t i = offset; i < sample.size(); ++i) {
+                    int next = row(curr)[byte_classes[(unsigned char)sample[i]]];
+                    if (next == -1) break;
+                    curr = next;
+                    state_visits[curr]++;
+                }
+            }
+        }
+        table_dirty = true;
+    }
+
+    int get_byte_classes_count() {
+        if (table_dirty) build_table();
+        return nb_classes;
+    }
+
+    const std::vector<int>& get_byte_classes() {
+        if (table_dirty) build_table();
+        return byte_classes;
+    }
+
+    // the dense table is the fastest to scan, the comb table only stores the transitions that
+    // differ from the most frequent one of each row and suits automatons with many states
+    void set_table_layout(TableLayout layout) {
+        // released rows are read back from the table in its current layout
+        restore_rows();
+        table_layout = layout;
+        table_dirty = true;
+    }
+
+    TableLayout get_table_layout() {
+        return table_layout;
+    }
+
+    // number of rows of the table including the dead row 0
+    int get_table_rows_count() {
+        if (table_dirty) build_table();
+        return nb_rows;
+    }
+
+    // row of the start state, 0 for an empty automaton
+    int get_table_start() {
+        if (table_dirty) build_table();
+        return table_start / row_stride;
+    }
+
+    // row reached from a row with a byte class, 0 when there is no transition
+    int get_table_next(int row, int byte_class) {
+        if (table_dirty) build_table();
+        return next_row(row, byte_class);
+    }
+
+    bool is_table_accepting(int row) {
+        if (table_dirty) build_table();
+        return row * row_stride >= accept_start;
+    }
+
+    // accepting row whose transitions all go to the dead row, the match can't be extended
+    bool is_table_final(int row) {
+        if (table_dirty) build_table();
+        return row * row_stride >= final_start;
+    }
+
+    // states merged into the dead row because no accepting state can be reached from them,
+    // including those removed by minimize()
+    int get_dead_states_count() {
+        if (table_dirty) build_table();
+        return nb_dead_states + dead_states_removed;
+    }
+
+    // size in bytes of the entries of the dense table (2 or 4)
+    int get_table_entry_size() {
+        if (table_dirty) build_table();
+        return entry_size;
+    }
+
+    // memory used by the scan representation in bytes
+    size_t get_table_memory() {
+        if (table_dirty) build_table();
+        size_t size = table16.size() * sizeof(uint16_t) + table32.size() * sizeof(uint32_t);
+        size += comb.size() * sizeof(CombEntry) + (comb_base.size() + comb_default.size()) * sizeof(int);
+        size += (byte_classes.size() + row_tags.size() + state_ids.size()) * sizeof(int);
+        // the rows restored by save() or get_transition_table()
+        for (auto& [s, targets] : transition_table) size += sizeof(s) + targets.size() * sizeof(int);
+        return size;
+    }
+
+    // merges equivalent states with hopcroft's partition refinement over the byte classes.
+    // missing transitions go to an extra dead state, the states equivalent to it are removed
+    // along with the transitions leading to them. returns false and clears the automaton when
+    // it takes longer than max_time ms (0 for no limit)
+    bool minimize(double max_time = 0) {
+        if (start_state == -1) return true;
+        restore_rows();
+        auto start_time = CompileStats::clock::now();
+        row(start_state);
+        std::vector<int> ids;
+        std::map<int, int> index;
+        for (auto& [s, targets] : transition_table) {
+            index[s] = (int)ids.size();
+            ids.push_back(s);
+        }
+        int dead = (int)ids.size();
+        int n = dead + 1;
+        std::vector<int> next((size_t)n * nb_classes, dead);
+        for (int i = 0; i < dead; ++i) {
+            const std::vector<int>& targets = transition_table[ids[i]];
+            for (int k = 0; k < nb_classes; ++k) {
+                if (targets[k] != -1) next[(size_t)i * nb_classes + k] = index[targets[k]];
+            }
+        }
+        // predecessors of every state by every class, those of state t by class k are
+        // sources[inverse[k * n + t]] to sources[inverse[k * n + t + 1] - 1]
+        std::vector<int> inverse((size_t)nb_classes * n + 1, 0);
+        std::vector<int> sources((size_t)n * nb_classes);
+        for (int i = 0; i < n; ++i) {
+            for (int k = 0; k < nb_classes; ++k) inverse[(size_t)k * n + next[(size_t)i * nb_classes + k] + 1]++;
+        }
+        for (size_t j = 1; j < inverse.size(); ++j) inverse[j] += inverse[j - 1];
+        std::vector<int> cursor(inverse.begin(), inverse.end() - 1);
+        for (int i = 0; i < n; ++i) {
+            for (int k = 0; k < nb_classes; ++k) sources[cursor[(size_t)k * n + next[(size_t)i * nb_classes + k]]++] = i;
+        }
+
+        // the states of block b are elements[first[b]] to elements[last[b] - 1], the marked
+        // ones being moved to the front of the block
+        std::vector<int> block(n), elements(n), position(n);
+        std::vector<int> first, last, marked;
+        std::map<int, int> initial;
+        for (int i = 0; i < n; ++i) {
+            int label = i < dead && end_states.find(ids[i]) != end_states.end() ? end_tags[ids[i]] + 1 : 0;
+            block[i] = initial.insert({label, (int)initial.size()}).first->second;
+        }
+        int nb_blocks = (int)initial.size();
+        first.assign(nb_blocks + 1, 0);
+        for (int i = 0; i < n; ++i) first[block[i] + 1]++;
+        for (int b = 0; b < nb_blocks; ++b) first[b + 1] += first[b];
+        last.assign(first.begin() + 1, first.end());
+        first.pop_back();
+        marked.assign(nb_blocks, 0);
+        std::vector<int> fill(first);
+        for (int i = 0; i < n; ++i) {
+            position[i] = fill[block[i]]++;
+            elements[position[i]] = i;
+        }
+
+        // a block is split by every class at once, when a block already waiting is split
+        // both parts wait, otherwise only the smaller one
+        std::vector<int> waiting;
+        std::vector<bool> is_waiting(nb_blocks, true);
+        for (int b = 0; b < nb_blocks; ++b) waiting.push_back(b);
+        std::vector<int> splitter, touched;
+        while (!waiting.empty()) {
+            if (max_time > 0 && CompileStats::elapsed_ms(start_time, CompileStats::clock::now()) > max_time) {
+                clear();
+                return false;
+            }
+            int a = waiting.back();
+            waiting.pop_back();
+            is_waiting[a] = false;
+            splitter.assign(elements.begin() + first[a], elements.begin() + last[a]);
+            for (int k = 0; k < nb_classes; ++k) {
+                touched.clear();
+                for (int t : splitter) {
+                    for (int j = inverse[(size_t)k * n + t]; j < inverse[(size_t)k * n + t + 1]; ++j) {
+                        int p = sources[j];
+                        int b = block[p];
+                        int front = first[b] + marked[b];
+                        if (position[p] < front) continue;
+                        int q = elements[front];
+                        std::swap(elements[position[p]], elements[front]);
+                        position[q] = position[p];
+                        position[p] = front;
+                        if (marked[b]++ == 0) touched.push_back(b);
+                    }
+                }
+                for (int b : touched) {
+                    int nb_marked = marked[b];
+                    marked[b] = 0;
+                    if (nb_marked == last[b] - first[b]) continue;
+                    int c = nb_blocks++;
+                    first.push_back(first[b]);
+                    last.push_back(first[b] + nb_marked);
+                    marked.push_back(0);
+                    first[b] += nb_marked;
+                    for (int j = first[c]; j < last[c]; ++j) block[elements[j]] = c;
+                    if (is_waiting[b] || nb_marked <= last[b] - first[b]) {
+                        waiting.push_back(c);
+                        is_waiting.push_back(true);
+                    } else {
+                        waiting.push_back(b);
+                        is_waiting[b] = true;
+                        is_waiting.push_back(false);
+                    }
+                }
+            }
+        }
+
+        // the smallest state of each block represents it
+        std::vector<int> representative(nb_blocks, -1);
+        for (int i = 0; i < dead; ++i) {
+            if (representative[block[i]] == -1) representative[block[i]] = i;
+        }
+        int dead_block = block[dead];
+        dead_states_removed += last[dead_block] - first[dead_block] - 1;
+        int start = index[start_state];
+        std::map<int, std::vector<int>> table;
+        std::set<int> ends;
+        std::map<int, int> tags;
+        if (block[start] == dead_block) {
+            // nothing is accepted, the start state is kept without transitions
+            table[start_state] = std::vector<int>(nb_classes, -1);
+        } else {
+            for (int i = 0; i < dead; ++i) {
+                if (representative[block[i]] != i || block[i] == dead_block) continue;
+                std::vector<int> targets(nb_classes, -1);
+                for (int k = 0; k < nb_classes; ++k) {
+                    int b = block[next[(size_t)i * nb_classes + k]];
+                    if (b != dead_block) targets[k] = ids[representative[b]];
+                }
+                table[ids[i]] = targets;
+            }
+            for (int s : end_states) {
+                int r = ids[representative[block[index[s]]]];
+                ends.insert(r);
+                tags[r] = end_tags[s];
+            }
+            start_state = ids[representative[block[start]]];
+        }
+        transition_table = table;
+        end_states = ends;
+        end_tags = tags;
+        state_visits.clear();
+        table_dirty = true;
+        return true;
     }
 
     void clear() {
         transition_table.clear();
+        state_ids.clear();
+        rows_released = false;
+        dead_states_removed = 0;
+        byte_classes.assign(256, 0);
+        nb_classes = 1;
+        state_visits.clear();
         end_states.clear();
+        end_tags.clear();
         start_state = -1;
+        table_dirty = true;
     }
 
     void set_start_state(int s) {
         this->start_state = s;
+        table_dirty = true;
     }
 
     int get_start_state() {
         return this->start_state;
     }
 
-    void add_end_state(int s) {
+    // when a state is added several times with different tags the smallest tag is kept
+    void add_end_state(int s, int tag = 0) {
+        restore_rows();
+        auto it = end_tags.find(s);
+        if (it == end_tags.end() || tag < it->second) end_tags[s] = tag;
         this->end_states.insert(s);
+        table_dirty = true;
     }
 
     void set_end_states(std::set<int> states) {
-        this->end_states = states;
+        restore_rows();
+        this->end_states.clear();
+        this->end_tags.clear();
+        for (int s : states) add_end_state(s);
+    }
+
+    int get_end_tag(int s) {
+        restore_rows();
+        auto it = end_tags.find(s);
+        return it != end_tags.end() ? it->second : -1;
     }
 
     std::set<int> get_end_states() {
+        restore_rows();
         return this->end_states;
     }
     
     void add_transition(int s1, char c, int s2) {
-        transition_table[s1][c] = s2;
+        add_transition(s1, CharSet().set((unsigned char)c), s2);
+    }
+
+    void add_transition(int s1, const CharSet& chars, int s2) {
+        restore_rows();
+        table_dirty = true;
+        split_classes(chars);
+        std::vector<int>& targets = row(s1);
         // make sure the second state is added to the automaton
-        transition_table[s2];
+        row(s2);
+        for (int c = 0; c < 256; ++c) {
+            if (chars[c]) targets[byte_classes[c]] = s2;
+        }
     }
 
-    std::map<int, std::map<char, int>> get_transition_table() {
+    // rows indexed by the classes of get_byte_classes()
+    const std::map<int, std::vector<int>>& get_transition_table() {
+        if (table_dirty) build_table();
+        restore_rows();
         return transition_table;
     }
 
+    // -1 without transition
     int get_next_state(int s, char c) {
-        if (transition_table[s].find(c) == transition_table[s].end()) return {};
-        return transition_table[s][c];
+        restore_rows();
+        auto it = transition_table.find(s);
+        if (it == transition_table.end()) return -1;
+        return it->second[byte_classes[(unsigned char)c]];
     }
 
     int get_states_count() {
-        return (int)transition_table.size();
+        return rows_released ? (int)state_ids.size() : (int)transition_table.size();
     }
 
     std::set<int> get_states() {
+        restore_rows();
         std::set<int> res;
         for (auto& [k, v] : transition_table) res.insert(k);
         return res;
     }
 
     void print() {
+        bool released = rows_released;
+        restore_rows();
         std::cout << "deterministic automaton " << std::endl;
         std::cout << "start state : " << start_state << std::endl;
         std::cout << "end states : ";
         for (int i : end_states) std::cout << i << " ";
         std::cout << std::endl;
         std::cout << "transition table : " << std::endl;
-        for (auto& [s1, m] : this->transition_table) {
+        for (auto& [s1, targets] : this->transition_table) {
             std::cout << s1 << " => ";
-            for (auto [c, s2] : m) {
-                std::cout << "(" << c << ", " << s2 << ")" " ";
+            std::map<int, CharSet> labels;
+            for (int c = 0; c < 256; ++c) {
+                if (targets[byte_classes[c]] != -1) labels[targets[byte_classes[c]]].set(c);
+            }
+            for (auto& [s2, chars] : labels) {
+                std::cout << "(" << charset_to_string(chars) << ", " << s2 << ")" " ";
             }
             std::cout << std::endl;
         }
+        if (released) release_rows();
     }
 };
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "DetAutomaton.hpp"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#include <sys/mman.h>
+#define DFA_JIT_SUPPORTED 1
+#endif
+
+// compiles the dense table of a deterministic automaton to x86-64 code : every row is a block
+// that records the accept position in rax, loads the next byte and jumps to the next state
+// through a binary tree of comparisons over the byte ranges going to the same state, final
+// rows return at once.
+// on other architectures compile() fails and the table walker is used instead
+class DfaJit {
+private:
+    // rdi : current position, rsi : end of the input, rdx : beginning of the input,
+    // rax : position after the last accepted byte or 0
+    typedef long (*MatchFunction)(const unsigned char* begin, const unsigned char* end);
+
+    static const size_t MAX_CODE_SIZE = 64 * 1024 * 1024;
+
+    std::vector<unsigned char> code;
+    // positions of rel32 operands and the label they jump to
+    std::vector<std::pair<size_t, int>> fixups;
+    std::vector<size_t> labels;
+    void* buffer = nullptr;
+    size_t buffer_size = 0;
+    MatchFunction function = nullptr;
+
+    void emit(std::initializer_list<unsigned char> bytes) {
+        code.insert(code.end(), bytes);
+    }
+
+    void emit_imm32(int32_t value) {
+        for (int i = 0; i < 4; ++i) code.push_back((unsigned char)(value >> (8 * i)));
+    }
+
+    void emit_jump(std::initializer_list<unsigned char> opcode, int label) {
+        emit(opcode);
+        fixups.push_back({code.size(), label});
+        emit_imm32(0);
+    }
+
+    int new_label() {
+        labels.push_back(0);
+        return (int)labels.size() - 1;
+    }
+
+    void bind(int label) {
+        labels[label] = code.size();
+    }
+
+    // runs[l..r] are consecutive byte ranges {first byte, label}, the byte is in ecx
+    void emit_dispatch(const std::vector<std::pair<int, int>>& runs, int l, int r) {
+        if (l == r) {
+            emit_jump({0xE9}, runs[l].second); // jmp
+            return;
+        }
+        int m = (l + r + 1) / 2;
+        int left = new_label();
+        emit({0x81, 0xF9}); // cmp ecx, imm32
+        emit_imm32(runs[m].first);
+        emit_jump({0x0F, 0x82}, left); // jb
+        emit_dispatch(runs, m, r);
+        bind(left);
+        emit_dispatch(runs, l, m - 1);
+    }
+
+    void release() {
+#ifdef DFA_JIT_SUPPORTED
+        if (buffer != nullptr) munmap(buffer, buffer_size);
+#endif
+        buffer = nullptr;
+        function = nullptr;
+    }
+
+public:
+    DfaJit() { }
+    DfaJit(const DfaJit&) = delete;
+    DfaJit& operator=(const DfaJit&) = delete;
+
+    ~DfaJit() {
+        release();
+    }
+
+    bool is_compiled() {
+        return function != nullptr;
+    }
+
+    size_t get_code_size() {
+        return buffer != nullptr ? buffer_size : 0;
+    }
+
+    bool compile(DetAutomaton& automaton) {
+        release();
+#ifdef DFA_JIT_SUPPORTED
+        const std::vector<int>& byte_classes = automaton.get_byte_classes();
+        int start = automaton.get_table_start();
+        if (start == 0) return false;
+        int nb_rows = automaton.get_table_rows_count();
+
+        code.clear();
+        fixups.clear();
+        // the label of a row is its index, the dead row 0 is the exit block
+        labels.assign(nb_rows, 0);
+        int exit = 0;
+        int fail = new_label();
+
+        emit({0x48, 0x89, 0xFA}); // mov rdx, rdi
+        emit({0x31, 0xC0}); // xor eax, eax
+        emit_jump({0xE9}, start); // jmp start
+        for (int s = 1; s < nb_rows; ++s) {
+            bind(s);
+            if (automaton.is_table_accepting(s)) emit({0x48, 0x89, 0xF8}); // mov rax, rdi
+            if (automaton.is_table_final(s)) {
+                emit_jump({0xE9}, exit); // jmp exit
+                continue;
+            }
+            emit({0x48, 0x39, 0xF7}); // cmp rdi, rsi
+            emit_jump({0x0F, 0x83}, exit); // jae exit
+            emit({0x0F, 0xB6, 0x0F}); // movzx ecx, byte [rdi]
+            emit({0x48, 0xFF, 0xC7}); // inc rdi
+            std::vector<std::pair<int, int>> runs;
+            for (int c = 0; c < 256; ++c) {
+                int label = automaton.get_table_next(s, byte_classes[c]);
+                if (runs.empty() || runs.back().second != label) runs.push_back({c, label});
+            }
+            emit_dispatch(runs, 0, (int)runs.size() - 1);
+            if (code.size() > MAX_CODE_SIZE) return false;
+        }
+        bind(exit);
+        emit({0x48, 0x85, 0xC0}); // test rax, rax
+        emit_jump({0x0F, 0x84}, fail); // jz fail
+        emit({0x48, 0x29, 0xD0}); // sub rax, rdx
+        emit({0xC3}); // ret
+        bind(fail);
+        emit({0x48, 0xC7, 0xC0}); // mov rax, -1
+        emit_imm32(-1);
+        emit({0xC3}); // ret
+
+        for (auto [pos, label] : fixups) {
+            int32_t rel = (int32_t)((long long)labels[label] - (long long)(pos + 4));
+            std::memcpy(&code[pos], &rel, 4);
+        }
+
+        buffer_size = code.size();
+        buffer = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            buffer = nullptr;
+            return false;
+        }
+        std::memcpy(buffer, code.data(), code.size());
+        code.clear();
+        code.shrink_to_fit();
+        if (mprotect(buffer, buffer_size, PROT_READ | PROT_EXEC) != 0) {
+            release();
+            return false;
+        }
+        function = (MatchFunction)buffer;
+        return true;
+#else
+        (void)automaton;
+        return false;
+#endif
+    }
+
+    // length of the longest prefix of [begin, end) accepted by the automaton or -1
+    int longest_match(const unsigned char* begin, const unsigned char* end) {
+        return (int)function(begin, end);
+    }
+};
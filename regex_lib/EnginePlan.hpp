@@ -0,0 +1,42 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+#include "CompileOptions.hpp"
+
+inline std::string engine_name(EngineType engine) {
+    switch (engine)
+    {
+    case EngineType::EagerDFA: return "deterministic automaton";
+    case EngineType::NFASimulation: return "non deterministic automaton simulation";
+    case EngineType::LiteralSet: return "literal set";
+    case EngineType::PrefilterDFA: return "literal prefilter and deterministic automaton";
+    case EngineType::BitParallel: return "bit parallel";
+    default: return "automatic";
+    }
+}
+
+// what the planner saw in the regex and the engine it picked, -1 for the values it didn't
+// need to compute
+struct EnginePlan {
+    EngineType engine = EngineType::EagerDFA;
+    int ast_nodes = 0;
+    int literals = -1;
+    // largest bound of the counted repetitions, 0 without counted repetition
+    int max_repeat = 0;
+    std::string prefix;
+    int nfa_states = -1;
+    // positions of the bit parallel automaton, -1 when there are more than 64
+    int positions = -1;
+    // states of the deterministic automaton before minimization, -1 when over budget
+    int dfa_states = -1;
+    std::string reason;
+
+    void print() {
+        std::cout << "engine : " << engine_name(engine) << " (" << reason << ")" << std::endl;
+        std::cout << "ast nodes : " << ast_nodes << ", literals : " << literals << ", max repeat : " << max_repeat << std::endl;
+        std::cout << "literal prefix : \"" << prefix << "\"" << std::endl;
+        std::cout << "nfa states : " << nfa_states << ", positions : " << positions << ", dfa states : " << dfa_states << std::endl;
+    }
+};
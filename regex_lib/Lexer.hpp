@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+
+#include "NDetAutomaton.hpp"
+#include "DetAutomaton.hpp"
+#include "RegexParser.hpp"
+#include "SubsetConstruction.hpp"
+#include "CompileOptions.hpp"
+
+// a token points into the scanned buffer, rule_id is the index of the rule that matched it
+// or -1 for a byte that no rule matches
+struct Token {
+    int rule_id;
+    std::string_view text;
+};
+
+// scans a buffer with an ordered list of rules using a single deterministic automaton,
+// every token is the longest match of any rule at the current position and when several
+// rules match the same length the first one in the list wins. the budgets of the options
+// apply to the automaton of all the rules, there is no fallback and large rule sets need a
+// higher max_dfa_states than the default 10000
+class Lexer {
+private:
+    DetAutomaton automaton;
+    CompileStatus status = CompileStatus::CompileOk;
+    std::string error;
+    std::string_view input;
+    size_t pos = 0;
+public:
+    Lexer(std::vector<std::string> rules, CompileOptions options = CompileOptions()) {
+        NDetAutomaton combined;
+        int start = generate_uid();
+        combined.set_start_state(start);
+        for (int i = 0; i < (int)rules.size(); ++i) {
+            RegexParser parser(rules[i], options);
+            try {
+                parser.parse();
+                parser.optimize();
+                parser.convert_to_nda();
+            } catch (const RegexError& e) {
+                status = e.status;
+                error = "rule " + std::to_string(i) + " : " + e.what();
+                return;
+            }
+            combined.add_automaton(parser.nd_automaton);
+            combined.add_transition(start, EPSILON, parser.nd_automaton.get_start_state());
+            for (int s : parser.nd_automaton.get_end_states()) combined.add_end_state(s, i);
+        }
+        // max_time covers both the subset construction and the minimization
+        auto start_time = CompileStats::clock::now();
+        bool built = SubsetConstruction(combined, options).run(automaton);
+        double remaining = options.max_time - CompileStats::elapsed_ms(start_time, CompileStats::clock::now());
+        if (built && options.max_time > 0 && remaining <= 0) built = false;
+        if (!built || !automaton.minimize(options.max_time > 0 ? remaining : 0)) {
+            status = CompileStatus::BudgetExceeded;
+            error = "deterministic automaton exceeds the compile budget";
+            return;
+        }
+        automaton.set_table_layout(options.table_layout);
+        automaton.build_table();
+    }
+
+    bool is_valid() {
+        return status == CompileStatus::CompileOk;
+    }
+
+    CompileStatus get_status() {
+        return status;
+    }
+
+    std::string get_error() {
+        return error;
+    }
+
+    // the buffer must outlive the tokens
+    void set_input(std::string_view t_input) {
+        input = t_input;
+        pos = 0;
+    }
+
+    // returns false at the end of the input or when the rules didn't compile, empty matches
+    // are reported as unmatched bytes
+    bool next(Token& token) {
+        if (status != CompileStatus::CompileOk || pos >= input.size()) return false;
+        const unsigned char* begin = (const unsigned char*)input.data();
+        int rule_id = -1;
+        int len = automaton.longest_match(begin + pos, begin + input.size(), &rule_id);
+        if (len <= 0) {
+            len = 1;
+            rule_id = -1;
+        }
+        token.rule_id = rule_id;
+        token.text = input.substr(pos, len);
+        pos += len;
+        return true;
+    }
+
+    std::vector<Token> tokenize(std::string_view t_input) {
+        std::vector<Token> res;
+        set_input(t_input);
+        Token token;
+        while (next(token)) res.push_back(token);
+        return res;
+    }
+
+    // reorders the states of the automaton so that those visited by the samples are contiguous
+    void optimize_layout(const std::vector<std::string>& samples) {
+        automaton.optimize_layout(samples);
+    }
+
+    void print_automaton() {
+        automaton.print();
+    }
+};
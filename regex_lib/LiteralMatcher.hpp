@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define LITERAL_MATCHER_TEDDY 1
+#endif
+
+// matches a set of literals without going through the automatons : the literals are stored
+// in an aho-corasick automaton whose transitions are a dense table (one row of byte classes per
+// state) so a scan is a single lookup per byte. small sets are searched with a teddy scanner
+// that finds candidate positions 16 bytes at a time from the first bytes of every literal
+class LiteralMatcher {
+private:
+    std::vector<std::string> literals;
+    std::vector<int> byte_classes;
+    int nb_classes = 1;
+    // nb_classes transitions per state, the root is state 0
+    std::vector<int> table;
+    std::vector<int> depth;
+    // length of the literal ending at a state, -1 if the state is only a prefix
+    std::vector<int> literal_len;
+    // a literal is a suffix of the state
+    std::vector<char> has_output;
+    int min_len = 0;
+
+    // teddy masks : bit b of lo_masks[k][n] is set when a literal of bucket b has a byte
+    // with low nibble n at position k, same for hi_masks with the high nibble
+    static const int TEDDY_MAX_LITERALS = 32;
+    static const int TEDDY_BUCKETS = 8;
+    bool use_teddy = false;
+    int teddy_len = 0;
+    alignas(16) unsigned char lo_masks[3][16];
+    alignas(16) unsigned char hi_masks[3][16];
+    std::vector<int> buckets[TEDDY_BUCKETS];
+
+    int add_state(int d) {
+        table.resize(table.size() + nb_classes, -1);
+        depth.push_back(d);
+        literal_len.push_back(-1);
+        has_output.push_back(false);
+        return (int)depth.size() - 1;
+    }
+
+    void build_teddy() {
+        use_teddy = false;
+#ifdef LITERAL_MATCHER_TEDDY
+        if (literals.size() > TEDDY_MAX_LITERALS || !__builtin_cpu_supports("ssse3")) return;
+        teddy_len = std::min(min_len, 3);
+        for (std::vector<int>& bucket : buckets) bucket.clear();
+        std::memset(lo_masks, 0, sizeof(lo_masks));
+        std::memset(hi_masks, 0, sizeof(hi_masks));
+        for (int i = 0; i < (int)literals.size(); ++i) {
+            int b = i % TEDDY_BUCKETS;
+            buckets[b].push_back(i);
+            for (int k = 0; k < teddy_len; ++k) {
+                unsigned char c = literals[i][k];
+                lo_masks[k][c & 0xF] |= 1 << b;
+                hi_masks[k][c >> 4] |= 1 << b;
+            }
+        }
+        use_teddy = true;
+#endif
+    }
+
+    // leftmost longest match among the literals starting in [lo, hi]
+    std::pair<int, int> first_match(const unsigned char* begin, int size, int lo, int hi) {
+        for (int p = lo; p <= hi; ++p) {
+            int len = match(begin, size, p);
+            if (len != -1) return {p, len};
+        }
+        return {-1, -1};
+    }
+
+    std::pair<int, int> search_automaton(const unsigned char* begin, int size, int offset) {
+        const int* rows = table.data();
+        const int* classes = byte_classes.data();
+        int s = 0;
+        for (int i = offset; i < size; ++i) {
+            s = rows[s * nb_classes + classes[begin[i]]];
+            if (has_output[s]) {
+                // a literal ends here, the leftmost one starts at most depth bytes before
+                return first_match(begin, size, i + 1 - depth[s], i + 1 - min_len);
+            }
+        }
+        return {-1, -1};
+    }
+
+#ifdef LITERAL_MATCHER_TEDDY
+    __attribute__((target("ssse3")))
+    std::pair<int, int> search_teddy(const unsigned char* begin, int size, int offset) {
+        const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+        __m128i lo[3], hi[3];
+        for (int k = 0; k < teddy_len; ++k) {
+            lo[k] = _mm_load_si128((const __m128i*)lo_masks[k]);
+            hi[k] = _mm_load_si128((const __m128i*)hi_masks[k]);
+        }
+        int i = offset;
+        for (; i + 16 + teddy_len - 1 <= size; i += 16) {
+            __m128i res = _mm_set1_epi8((char)0xFF);
+            for (int k = 0; k < teddy_len; ++k) {
+                __m128i chunk = _mm_loadu_si128((const __m128i*)(begin + i + k));
+                __m128i lo_res = _mm_shuffle_epi8(lo[k], _mm_and_si128(chunk, nibble_mask));
+                __m128i hi_res = _mm_shuffle_epi8(hi[k], _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble_mask));
+                res = _mm_and_si128(res, _mm_and_si128(lo_res, hi_res));
+            }
+            unsigned int candidates = ~_mm_movemask_epi8(_mm_cmpeq_epi8(res, _mm_setzero_si128())) & 0xFFFF;
+            while (candidates != 0) {
+                int j = __builtin_ctz(candidates);
+                candidates &= candidates - 1;
+                unsigned char bucket_bits = ((unsigned char*)&res)[j];
+                int best = -1;
+                for (int b = 0; b < TEDDY_BUCKETS; ++b) {
+                    if (!(bucket_bits & (1 << b))) continue;
+                    for (int l : buckets[b]) {
+                        int len = (int)literals[l].size();
+                        if (len > best && i + j + len <= size && std::memcmp(begin + i + j, literals[l].data(), len) == 0) best = len;
+                    }
+                }
+                if (best != -1) return {i + j, best};
+            }
+        }
+        // the last bytes are too few for a full chunk
+        return search_automaton(begin, size, i);
+    }
+#endif
+
+public:
+    LiteralMatcher() { }
+
+    void build(const std::vector<std::string>& t_literals) {
+        literals = t_literals;
+        std::sort(literals.begin(), literals.end());
+        literals.erase(std::unique(literals.begin(), literals.end()), literals.end());
+        min_len = literals.empty() ? 0 : (int)literals[0].size();
+        for (const std::string& literal : literals) min_len = std::min(min_len, (int)literal.size());
+
+        // bytes that don't appear in any literal share class 0
+        byte_classes.assign(256, 0);
+        nb_classes = 1;
+        for (const std::string& literal : literals) {
+            for (unsigned char c : literal) {
+                if (byte_classes[c] == 0) byte_classes[c] = nb_classes++;
+            }
+        }
+
+        table.clear();
+        depth.clear();
+        literal_len.clear();
+        has_output.clear();
+        add_state(0);
+        for (const std::string& literal : literals) {
+            int s = 0;
+            for (unsigned char c : literal) {
+                int k = byte_classes[c];
+                if (table[s * nb_classes + k] == -1) {
+                    int next = add_state(depth[s] + 1);
+                    table[s * nb_classes + k] = next;
+                }
+                s = table[s * nb_classes + k];
+            }
+            literal_len[s] = (int)literal.size();
+            has_output[s] = true;
+        }
+
+        // breadth first order : the failure state of a state is resolved before it, missing
+        // transitions are replaced by the transitions of the failure state
+        std::vector<int> failure(depth.size(), 0);
+        std::vector<int> queue;
+        for (int k = 0; k < nb_classes; ++k) {
+            int& next = table[k];
+            if (next == -1) next = 0;
+            else queue.push_back(next);
+        }
+        for (int i = 0; i < (int)queue.size(); ++i) {
+            int s = queue[i];
+            if (has_output[failure[s]]) has_output[s] = true;
+            for (int k = 0; k < nb_classes; ++k) {
+                int& next = table[s * nb_classes + k];
+                if (next == -1) {
+                    next = table[failure[s] * nb_classes + k];
+                } else {
+                    failure[next] = table[failure[s] * nb_classes + k];
+                    queue.push_back(next);
+                }
+            }
+        }
+        build_teddy();
+    }
+
+    int get_literals_count() {
+        return (int)literals.size();
+    }
+
+    int get_states_count() {
+        return (int)depth.size();
+    }
+
+    // longest literal starting at offset, the walk stops when a transition leaves the trie
+    int match(const unsigned char* begin, int size, int offset) {
+        if (literals.empty()) return -1;
+        int s = 0;
+        int matched = literal_len[0];
+        for (int i = offset; i < size; ++i) {
+            int next = table[s * nb_classes + byte_classes[begin[i]]];
+            if (depth[next] != depth[s] + 1) break;
+            s = next;
+            if (literal_len[s] != -1) matched = literal_len[s];
+        }
+        return matched;
+    }
+
+    int match(const std::string& str, int offset = 0) {
+        return match((const unsigned char*)str.data(), (int)str.size(), offset);
+    }
+
+    // leftmost longest match starting at or after offset, returns {start, length} or {-1, -1}
+    std::pair<int, int> search(const std::string& str, int offset = 0) {
+        if (literals.empty()) return {-1, -1};
+        const unsigned char* begin = (const unsigned char*)str.data();
+        int size = (int)str.size();
+        if (min_len == 0) return {offset, match(begin, size, offset)};
+#ifdef LITERAL_MATCHER_TEDDY
+        if (use_teddy) return search_teddy(begin, size, offset);
+#endif
+        return search_automaton(begin, size, offset);
+    }
+};
@@ -3,13 +3,23 @@
 
 #pragma once
 
+#include <unordered_set>
+#include <algorithm>
+
 #include "Commun.hpp"
 
+// transitions are labeled with sets of bytes, epsilon transitions are kept in their own table
+// in the order they were added, which gives the priority used to pick capture groups
 class NDetAutomaton {
 private:
-    std::map<int, std::map<char, std::set<int>>> transition_table;
+    std::map<int, std::vector<std::pair<CharSet, int>>> transition_table;
+    std::map<int, std::vector<int>> epsilon_table;
     int start_state = -1;
     std::set<int> end_states;
+    std::map<int, int> end_tags;
+    // capture slots saved when going through a state, group k uses slots 2k and 2k + 1
+    std::map<int, int> state_tags;
+    int closure_calls = 0;
 public:
     explicit NDetAutomaton() {
         transition_table.clear();
@@ -19,23 +29,75 @@ public:
         this->start_state = s;
     }
 
-    void add_end_state(int s) {
+    // the tag tells which sub expression an end state belongs to when several
+    // expressions are combined in the same automaton
+    void add_end_state(int s, int tag = 0) {
         this->end_states.insert(s);
+        this->end_tags[s] = tag;
+    }
+
+    int get_end_tag(int s) {
+        auto it = end_tags.find(s);
+        return it != end_tags.end() ? it->second : -1;
+    }
+
+    void set_state_tag(int s, int slot) {
+        this->state_tags[s] = slot;
+    }
+
+    int get_state_tag(int s) {
+        auto it = state_tags.find(s);
+        return it != state_tags.end() ? it->second : -1;
+    }
+
+    // adds the states and transitions of another automaton, the states ids being unique
+    // the two automatons don't share any state
+    void add_automaton(NDetAutomaton& other) {
+        for (auto& [s1, edges] : other.transition_table) {
+            transition_table[s1];
+            for (auto& [label, s2] : edges) add_transition(s1, label, s2);
+        }
+        for (auto& [s1, states] : other.epsilon_table) {
+            for (int s2 : states) add_transition(s1, EPSILON, s2);
+        }
+        for (auto [s, slot] : other.state_tags) set_state_tag(s, slot);
     }
     
     void add_transition(int s1, char c, int s2) {
-        transition_table[s1][c].insert(s2);
+        if (c == EPSILON) {
+            auto& states = epsilon_table[s1];
+            if (std::find(states.begin(), states.end(), s2) == states.end()) states.push_back(s2);
+            // make sure the states are considered
+            transition_table[s1];
+            transition_table[s2];
+            return;
+        }
+        add_transition(s1, CharSet().set((unsigned char)c), s2);
+    }
+
+    // transitions between the same states are merged into one label
+    void add_transition(int s1, const CharSet& chars, int s2) {
+        auto& edges = transition_table[s1];
         // make sure the state is considered
         transition_table[s2];
+        for (auto& [label, s] : edges) {
+            if (s != s2) continue;
+            label |= chars;
+            return;
+        }
+        edges.push_back({chars, s2});
     }
 
-    std::map<int, std::map<char, std::set<int>>> get_transition_table() {
+    const std::map<int, std::vector<std::pair<CharSet, int>>>& get_transition_table() {
         return transition_table;
     }
 
-    std::set<int> get_next_state(int s, char c) {
-        if (transition_table[s].find(c) == transition_table[s].end()) return {};
-        return transition_table[s][c];
+    const std::map<int, std::vector<int>>& get_epsilon_table() {
+        return epsilon_table;
+    }
+
+    std::set<int> get_next_state(int s, unsigned char c) {
+        return moves({s}, c);
     }
 
     int get_start_state() {
@@ -50,6 +112,48 @@ public:
         return (int)transition_table.size();
     }
 
+    int get_transitions_count() {
+        int res = get_epsilon_transitions_count();
+        for (auto& [s1, edges] : transition_table) res += (int)edges.size();
+        return res;
+    }
+
+    int get_epsilon_transitions_count() {
+        int res = 0;
+        for (auto& [s1, states] : epsilon_table) res += (int)states.size();
+        return res;
+    }
+
+    // bytes that no transition label tells apart share the same class, the subset
+    // construction only has to look at one byte of each class
+    std::vector<int> get_byte_classes() {
+        std::vector<int> classes(256, 0);
+        int nb_classes = 1;
+        std::unordered_set<CharSet> labels;
+        for (auto& [s1, edges] : transition_table) {
+            for (auto& [label, s2] : edges) labels.insert(label);
+        }
+        for (const CharSet& label : labels) {
+            std::vector<int> refined(2 * nb_classes, -1);
+            int nb_refined = 0;
+            for (int c = 0; c < 256; ++c) {
+                int key = 2 * classes[c] + (label[c] ? 1 : 0);
+                if (refined[key] == -1) refined[key] = nb_refined++;
+                classes[c] = refined[key];
+            }
+            nb_classes = nb_refined;
+        }
+        return classes;
+    }
+
+    int get_closure_calls() {
+        return this->closure_calls;
+    }
+
+    void add_closure_calls(int nb_calls) {
+        this->closure_calls += nb_calls;
+    }
+
     std::set<int> get_states() {
         std::set<int> res;
         for (auto& [k, v] : transition_table) res.insert(k);
@@ -57,13 +161,21 @@ public:
     }
 
     std::set<int> closure(std::set<int> states_set) {
+        closure_calls++;
+        return epsilon_closure(states_set);
+    }
+
+    // same as closure() without updating the counter, safe to call from several threads
+    std::set<int> epsilon_closure(const std::set<int>& states_set) const {
         std::set<int> res = states_set;
         std::stack<int> states;
         for (int k : states_set) states.push(k);
         while (!states.empty()) {
             int current = states.top();
             states.pop();
-            for (int s : this->transition_table[current][EPSILON]) {
+            auto it = epsilon_table.find(current);
+            if (it == epsilon_table.end()) continue;
+            for (int s : it->second) {
                 if (res.find(s) == res.end()) {
                     res.insert(s);
                     states.push(s);
@@ -73,39 +185,39 @@ public:
         return res;
     }
 
-    std::set<int> moves(std::set<int> states_set, char alpha) {
+    std::set<int> moves(std::set<int> states_set, unsigned char alpha) {
         std::set<int> res;
         for (int s1 : states_set) {
-            for (int s2 : transition_table[s1][alpha]) {
-                res.insert(s2);
+            auto it = transition_table.find(s1);
+            if (it == transition_table.end()) continue;
+            for (auto& [label, s2] : it->second) {
+                if (label[alpha]) res.insert(s2);
             }
         }
         return res;
     }
 
-    std::tuple<int, std::set<int>, std::map<int, std::map<char, std::set<int>>>> copy_automaton(int start, std::set<int> end) {
-        std::map<int, std::map<char, std::set<int>>> res;
-        std::map<int, int> id_mapping;
-        std::set<int> visited;
-        std::stack<int> to_be_visited;
-        to_be_visited.push(start);
-        while (!to_be_visited.empty()) {
-            int curr = to_be_visited.top();
-            to_be_visited.pop();
-            if (visited.find(curr) != visited.end()) continue;
-            visited.insert(curr);
-            if (id_mapping.find(curr) == id_mapping.end()) id_mapping[curr] = generate_uid();
-            for (auto [c, next_states] : transition_table[curr]) {
-                for (int s : next_states) {
-                    if (id_mapping.find(s) == id_mapping.end()) id_mapping[s] = generate_uid();
-                    res[id_mapping[curr]][c].insert(id_mapping[s]);
-                    if (visited.find(s) == visited.end()) to_be_visited.push(s);
+    // simulate the automaton on the fly, slower than the deterministic automaton but
+    // bounded by the automaton size for each input character
+    int match(const std::string& str, int offset = 0) {
+        if (start_state == -1) return -1;
+        std::set<int> curr = closure({start_state});
+        int str_pos = offset;
+        int last_matched = -1;
+        while (true) {
+            for (int s : curr) {
+                if (end_states.find(s) != end_states.end()) {
+                    last_matched = str_pos;
+                    break;
                 }
             }
+            if (str_pos >= (int)str.size()) break;
+            std::set<int> next = moves(curr, (unsigned char)str[str_pos]);
+            if (next.empty()) break;
+            curr = closure(next);
+            str_pos++;
         }
-        std::set<int> end_set;
-        for (int e : end) end_set.insert(id_mapping[e]);
-        return {id_mapping[start], end_set, res};
+        return last_matched != -1 ? last_matched - offset : -1;
     }
 
     std::pair<int, std::set<int>> copy_automaton_inplace(int start, std::set<int> end) {
@@ -119,12 +231,18 @@ public:
             if (visited.find(curr) != visited.end()) continue;
             visited.insert(curr);
             if (id_mapping.find(curr) == id_mapping.end()) id_mapping[curr] = generate_uid();
-            for (auto [c, next_states] : transition_table[curr]) {
-                for (int s : next_states) {
-                    if (id_mapping.find(s) == id_mapping.end()) id_mapping[s] = generate_uid();
-                    this->add_transition(id_mapping[curr],  c, id_mapping[s]);
-                    if (visited.find(s) == visited.end()) to_be_visited.push(s);
-                }
+            if (get_state_tag(curr) != -1) set_state_tag(id_mapping[curr], get_state_tag(curr));
+            auto edges = transition_table[curr];
+            for (auto& [label, s] : edges) {
+                if (id_mapping.find(s) == id_mapping.end()) id_mapping[s] = generate_uid();
+                this->add_transition(id_mapping[curr], label, id_mapping[s]);
+                if (visited.find(s) == visited.end()) to_be_visited.push(s);
+            }
+            auto epsilon_edges = epsilon_table[curr];
+            for (int s : epsilon_edges) {
+                if (id_mapping.find(s) == id_mapping.end()) id_mapping[s] = generate_uid();
+                this->add_transition(id_mapping[curr], EPSILON, id_mapping[s]);
+                if (visited.find(s) == visited.end()) to_be_visited.push(s);
             }
         }
         std::set<int> end_set;
@@ -139,12 +257,14 @@ public:
         for (int i : end_states) std::cout << i << " ";
         std::cout << std::endl;
         std::cout << "transition table : " << std::endl;
-        for (auto& [s1, m] : this->transition_table) {
+        for (auto& [s1, edges] : this->transition_table) {
             std::cout << s1 << " => ";
-            for (auto [c, states] : m) {
-                for (int s2 : states) {
-                    std::cout << "(" << c << ", " << s2 << ")" " ";
-                }
+            for (auto& [label, s2] : edges) {
+                std::cout << "(" << charset_to_string(label) << ", " << s2 << ")" " ";
+            }
+            auto it = epsilon_table.find(s1);
+            if (it != epsilon_table.end()) {
+                for (int s2 : it->second) std::cout << "(eps, " << s2 << ")" " ";
             }
             std::cout << std::endl;
         }
@@ -8,11 +8,30 @@
 #include <map>
 #include <stack>
 #include <tuple>
+#include <algorithm>
 
-enum NodeType {Pipe, Concat, StarRep, OptRep, PlusRep, ValRep, BoundedRep, CharSelect, CharExcl, Char};
+#include "Commun.hpp"
+
+// CharSelect and CharExcl hold ranges of bytes, CodePointSelect holds ranges of unicode code points
+// that are matched as UTF-8 sequences, Group holds the index of a capture group
+enum NodeType {Pipe, Concat, StarRep, OptRep, PlusRep, ValRep, BoundedRep, CharSelect, CharExcl, Char, CodePointSelect, Group};
+
+// inclusive ranges of characters used by CharSelect and CharExcl
+using CharRanges = std::vector<std::pair<int, int>>;
 
 class Node;
-using NodeValVariant = std::variant<std::set<char>, char, int, std::pair<int, int>, std::vector<Node*>>;
+using NodeValVariant = std::variant<CharRanges, char, int, std::pair<int, int>, std::vector<Node*>>;
+
+// sorts the ranges and merges the overlapping or adjacent ones
+inline CharRanges normalize_ranges(CharRanges ranges) {
+    std::sort(ranges.begin(), ranges.end());
+    CharRanges res;
+    for (auto [lo, hi] : ranges) {
+        if (!res.empty() && lo <= res.back().second + 1) res.back().second = std::max(res.back().second, hi);
+        else res.push_back({lo, hi});
+    }
+    return res;
+}
 
 class Node {
 public:
@@ -9,41 +9,296 @@
 #include <stack>
 #include <tuple>
 #include <regex>
+#include <memory>
 
 #include "Node.hpp"
 #include "NDetAutomaton.hpp"
 #include "DetAutomaton.hpp"
 #include "RegexParser.hpp"
+#include "CompileStats.hpp"
+#include "CompileOptions.hpp"
+#include "TaggedAutomaton.hpp"
+#include "LiteralMatcher.hpp"
+#include "DfaJit.hpp"
+#include "BitParallelMatcher.hpp"
+#include "EnginePlan.hpp"
 
 class Regex {
     RegexParser* parser = nullptr;
     DetAutomaton automaton;
+    // built on the first call to match_groups
+    TaggedAutomaton tagged_automaton;
+    LiteralMatcher literal_matcher;
+    BitParallelMatcher bit_parallel;
+    std::shared_ptr<DfaJit> jit;
+    CompileOptions options;
+    // literal sets skip the automatons until they are saved or printed
+    bool automatons_pending = false;
+    EngineType engine = EngineType::EagerDFA;
+    EnginePlan plan;
+    CompileStatus status = CompileStatus::CompileOk;
+    std::string error;
+    CompileStats compile_stats;
+    MatchStats match_stats;
+    bool collect_match_stats = false;
+    // states of the deterministic automaton before minimizing
+    int dfa_states = 0;
 private:
     Regex() {}
+
+    void select(EngineType t_engine, std::string reason) {
+        engine = t_engine;
+        plan.engine = t_engine;
+        plan.reason = reason;
+    }
+
+    bool uses_dfa() {
+        return engine == EngineType::EagerDFA || engine == EngineType::PrefilterDFA;
+    }
 public:
     static Regex* load(std::string file_path);
-    Regex(std::string regexp) {
-        parser = new RegexParser(regexp);
-        parser->parse();
-        parser->convert_to_nda();
-        parser->nd_automaton.print();
-        parser->convert_to_determistic(automaton);
+    // errors are reported through is_valid() and get_error(), an invalid regex never matches
+    Regex(std::string regexp, CompileOptions t_options = CompileOptions()) : options(t_options) {
+        using clock = CompileStats::clock;
+        parser = new RegexParser(regexp, options);
+        EngineType hint = options.engine_hint;
+        auto t0 = clock::now();
+        auto t1 = t0, t2 = t0, t3 = t0, t_opt = t0;
+        try {
+            parser->parse();
+            t_opt = clock::now();
+            compile_stats.ast_nodes = parser->count_ast_nodes();
+            plan.ast_nodes = compile_stats.ast_nodes;
+            plan.max_repeat = parser->get_max_repeat();
+            plan.prefix = parser->get_literal_prefix();
+            std::vector<std::string> literals;
+            bool literal_engine = options.max_literals > 0 && options.case_folding == CaseFolding::CaseSensitive;
+            if (literal_engine && parser->get_literals(literals, options.max_literals)) {
+                plan.literals = (int)literals.size();
+                if (hint == EngineType::Automatic || hint == EngineType::LiteralSet) {
+                    literal_matcher.build(literals);
+                    select(EngineType::LiteralSet, "alternation of " + std::to_string(literals.size()) + " literals");
+                    automatons_pending = true;
+                    compile_stats.parse_time = CompileStats::elapsed_ms(t0, t_opt);
+                    return;
+                }
+            }
+            parser->optimize();
+            t1 = clock::now();
+            parser->convert_to_nda();
+            t2 = clock::now();
+        } catch (const RegexError& e) {
+            status = e.status;
+            error = e.what();
+            return;
+        }
+        plan.nfa_states = parser->nd_automaton.get_states_count();
+        if (bit_parallel.build(parser->nd_automaton)) plan.positions = bit_parallel.get_positions_count();
+        t3 = clock::now();
+        if (hint == EngineType::NFASimulation) {
+            select(EngineType::NFASimulation, "engine hint");
+        } else if (hint == EngineType::BitParallel && plan.positions != -1) {
+            select(EngineType::BitParallel, "engine hint");
+        } else if (!parser->convert_to_determistic(automaton) || !minimize_within_budget(t2, t3)) {
+            t3 = clock::now();
+            if (!options.allow_fallback) {
+                status = CompileStatus::BudgetExceeded;
+                error = "deterministic automaton exceeds the compile budget";
+                return;
+            }
+            // both fallbacks are bounded by the automaton size, bit masks are much cheaper
+            if (plan.positions != -1) select(EngineType::BitParallel, "deterministic automaton over budget, " + std::to_string(plan.positions) + " positions");
+            else select(EngineType::NFASimulation, "deterministic automaton over budget");
+        } else {
+            plan.dfa_states = dfa_states;
+            if (!plan.prefix.empty() && (hint == EngineType::Automatic || hint == EngineType::PrefilterDFA)) {
+                select(EngineType::PrefilterDFA, "every match starts with a literal prefix");
+            } else {
+                select(EngineType::EagerDFA, hint == EngineType::EagerDFA ? "engine hint" : "no literal prefix");
+            }
+        }
+        if (hint != EngineType::Automatic && hint != engine) plan.reason += ", the hinted engine doesn't apply";
+        compile_stats.dfa_states = dfa_states;
+        if (uses_dfa()) {
+            automaton.set_table_layout(options.table_layout);
+            compile_stats.table_bytes = automaton.get_table_memory();
+            compile_stats.dead_states = automaton.get_dead_states_count();
+        }
+        if (uses_dfa() && options.jit) {
+            jit = std::make_shared<DfaJit>();
+            if (!jit->compile(automaton)) jit.reset();
+        }
+        auto t4 = clock::now();
+
+        compile_stats.optimized_ast_nodes = parser->count_ast_nodes();
+        compile_stats.nfa_states = parser->nd_automaton.get_states_count();
+        compile_stats.nfa_edges = parser->nd_automaton.get_transitions_count();
+        compile_stats.epsilon_edges = parser->nd_automaton.get_epsilon_transitions_count();
+        compile_stats.min_dfa_states = automaton.get_states_count();
+        compile_stats.peak_subset_size = parser->get_peak_subset_size();
+        compile_stats.closure_calls = parser->nd_automaton.get_closure_calls();
+        compile_stats.parse_time = CompileStats::elapsed_ms(t0, t_opt);
+        compile_stats.optimize_time = CompileStats::elapsed_ms(t_opt, t1);
+        compile_stats.thompson_time = CompileStats::elapsed_ms(t1, t2);
+        compile_stats.subset_time = CompileStats::elapsed_ms(t2, t3);
+        compile_stats.minimize_time = CompileStats::elapsed_ms(t3, t4);
+    }
+
+    bool is_valid() {
+        return status == CompileStatus::CompileOk;
+    }
+
+    CompileStatus get_status() {
+        return status;
+    }
+
+    std::string get_error() {
+        return error;
+    }
+
+    EngineType get_engine() {
+        return engine;
+    }
+
+    // the engine picked by the planner and what it was based on
+    EnginePlan get_plan() {
+        return plan;
+    }
+
+    bool is_jit_compiled() {
+        return jit != nullptr;
+    }
+
+    CompileStats get_compile_stats() {
+        return compile_stats;
+    }
+
+    // match counters are off by default to keep the scan loop free of bookkeeping. they are only
+    // collected by the deterministic automaton (EagerDFA and PrefilterDFA, the jit code being
+    // bypassed while they are on), returns false when the engine of the regex doesn't collect them
+    bool enable_match_stats(bool enable = true) {
+        collect_match_stats = enable;
+        return uses_dfa() && status == CompileStatus::CompileOk;
+    }
+
+    MatchStats get_match_stats() {
+        return match_stats;
+    }
+
+    void reset_match_stats() {
+        match_stats = MatchStats();
+    }
+
+    // reorders the states of the deterministic automaton so that those visited by the samples
+    // are contiguous, the jit code is regenerated in the new order
+    void optimize_layout(const std::vector<std::string>& samples) {
+        if (!uses_dfa() || status != CompileStatus::CompileOk) return;
+        automaton.optimize_layout(samples);
+        if (jit != nullptr && !jit->compile(automaton)) jit.reset();
     }
 
     void print_nda() {
+        build_automatons();
         parser->nd_automaton.print();
     }
 
     void print_automaton() {
+        build_automatons();
         automaton.print();
     }
 
-    int match(std::string str, int offset = 0) {
-        return automaton.match(str, offset);
+    int match(const std::string& str, int offset = 0) {
+        if (status != CompileStatus::CompileOk) return -1;
+        if (engine == EngineType::NFASimulation) return parser->nd_automaton.match(str, offset);
+        if (engine == EngineType::LiteralSet) return literal_matcher.match(str, offset);
+        if (engine == EngineType::BitParallel) return bit_parallel.match(str, offset);
+        if (jit != nullptr && !collect_match_stats) {
+            const unsigned char* begin = (const unsigned char*)str.data();
+            return jit->longest_match(begin + std::min(offset, (int)str.size()), begin + str.size());
+        }
+        return automaton.match(str, offset, collect_match_stats ? &match_stats : nullptr);
+    }
+
+    // number of capture groups, not counting the whole match
+    int get_groups_count() {
+        return parser != nullptr ? parser->get_groups_count() : 0;
+    }
+
+    // same match as match(), groups receives the (start, end) offsets of the whole match followed
+    // by those of every capture group, (-1, -1) for groups that did not take part in the match
+    int match_groups(const std::string& str, std::vector<std::pair<int, int>>& groups, int offset = 0) {
+        groups.assign(get_groups_count() + 1, {-1, -1});
+        if (status != CompileStatus::CompileOk) return -1;
+        // regexes loaded from a file only have the deterministic automaton and literals have no groups
+        if (parser == nullptr || engine == EngineType::LiteralSet) {
+            int len = match(str, offset);
+            if (len != -1) groups[0] = {offset, offset + len};
+            return len;
+        }
+        if (!tagged_automaton.is_built()) tagged_automaton.build(parser->nd_automaton, parser->get_groups_count());
+        int len = tagged_automaton.match(str, offset);
+        if (len == -1) return -1;
+        const std::vector<int>& slots = tagged_automaton.get_slots();
+        for (int i = 0; i < (int)groups.size(); ++i) {
+            if (slots[2 * i] != -1 && slots[2 * i + 1] != -1) groups[i] = {slots[2 * i], slots[2 * i + 1]};
+        }
+        return len;
+    }
+
+    // leftmost longest match starting at or after offset, returns {start, length} or {-1, -1}
+    std::pair<int, int> search(const std::string& str, int offset = 0) {
+        if (status != CompileStatus::CompileOk) return {-1, -1};
+        if (engine == EngineType::LiteralSet) return literal_matcher.search(str, offset);
+        if (engine == EngineType::PrefilterDFA) {
+            // every match starts with the prefix, the automaton only runs where it occurs
+            for (size_t start = str.find(plan.prefix, offset); start != std::string::npos; start = str.find(plan.prefix, start + 1)) {
+                int len = match(str, (int)start);
+                if (len != -1) return {(int)start, len};
+            }
+            return {-1, -1};
+        }
+        for (int start = offset; start <= (int)str.size(); ++start) {
+            int len = match(str, start);
+            if (len != -1) return {start, len};
+        }
+        return {-1, -1};
+    }
+
+    // only regexes compiled to a deterministic automaton can be saved
+    bool save(std::string file_path) {
+        if (status != CompileStatus::CompileOk) return false;
+        if (engine == EngineType::NFASimulation || engine == EngineType::BitParallel || !build_automatons()) return false;
+        return automaton.save(file_path);
+    }
+
+private:
+    // max_time covers the subset construction started at start_time and the minimization,
+    // which starts at minimize_time
+    bool minimize_within_budget(CompileStats::clock::time_point start_time, CompileStats::clock::time_point& minimize_time) {
+        minimize_time = CompileStats::clock::now();
+        dfa_states = automaton.get_states_count();
+        if (options.max_time <= 0) return automaton.minimize();
+        double remaining = options.max_time - CompileStats::elapsed_ms(start_time, minimize_time);
+        if (remaining <= 0) {
+            automaton.clear();
+            return false;
+        }
+        return automaton.minimize(remaining);
     }
 
-    void save(std::string file_path) {
-        automaton.save(file_path);
+    // returns false when the deterministic automaton goes over the compile budget
+    bool build_automatons() {
+        if (!automatons_pending) return automaton.get_states_count() > 0;
+        automatons_pending = false;
+        try {
+            parser->optimize();
+            parser->convert_to_nda();
+        } catch (const RegexError&) {
+            return false;
+        }
+        if (!parser->convert_to_determistic(automaton) || !automaton.minimize(options.max_time)) return false;
+        automaton.set_table_layout(options.table_layout);
+        return true;
     }
 };
 
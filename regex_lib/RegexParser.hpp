@@ -3,36 +3,108 @@
 #include "Node.hpp"
 #include "NDetAutomaton.hpp"
 #include "DetAutomaton.hpp"
-
-#define END_OF_INPUT '\0'
-#define DIGIT '\1'
-#define ALPHA '\2'
-#define ALPHANUM '\3'
+#include "SubsetConstruction.hpp"
+#include "CompileOptions.hpp"
+#include "AstOptimizer.hpp"
+#include "Utf8.hpp"
+#include "CaseFolding.hpp"
 
 class RegexParser {
 private:
     std::string regexp;
     int pos;
-    char curr;
+    int curr;
+    // number of pattern bytes of the current token
+    int curr_size = 0;
     Node* ast = nullptr;
+    int peak_subset_size = 0;
+    int nb_groups = 0;
+    // groups opened and not closed yet while parsing
+    int nesting = 0;
+    CompileOptions options;
 public:
     NDetAutomaton nd_automaton;
 public:
-    RegexParser(std::string expr) : regexp(expr) { }
+    RegexParser(std::string expr, CompileOptions t_options = CompileOptions()) : regexp(expr), options(t_options) { }
     ~RegexParser() {}
 
     void parse() {
         pos = 0;
         curr = current();
         ast = parse_expr();
+        // parse_expr() returns at a ) that doesn't close any group
+        if (pos < (int)regexp.size()) fatal_error("unmatched ) at " + std::to_string(pos));
+        check_tree_nesting();
+    }
+
+    void optimize() {
+        ast = AstOptimizer(nb_groups > 0).optimize(ast);
     }
 
     void convert_to_nda() {
         auto [start, end] = convert_ast2nda(ast);
+        check_nfa_budget();
         this->nd_automaton.set_start_state(start);
         this->nd_automaton.add_end_state(end);
     }
 
+    int count_ast_nodes() {
+        if (ast == nullptr) return 0;
+        int res = 0;
+        std::stack<Node*> nodes;
+        nodes.push(ast);
+        while (!nodes.empty()) {
+            Node* n = nodes.top();
+            nodes.pop();
+            res++;
+            for (Node* operand : n->operands) nodes.push(operand);
+        }
+        return res;
+    }
+
+    // expands a syntax tree made only of literals, alternations and concatenations into the
+    // list of strings it matches, returns false for other trees or when there are more than
+    // max_literals strings
+    bool get_literals(std::vector<std::string>& res, int max_literals) {
+        res.clear();
+        return ast != nullptr && collect_literals(ast, res, max_literals);
+    }
+
+    // bytes that every match starts with, empty when case folding is on
+    std::string get_literal_prefix() {
+        std::string res;
+        if (ast != nullptr && options.case_folding == CaseFolding::CaseSensitive) collect_prefix(ast, res);
+        return res;
+    }
+
+    // largest bound of the counted repetitions of the syntax tree
+    int get_max_repeat() {
+        if (ast == nullptr) return 0;
+        int res = 0;
+        std::stack<Node*> nodes;
+        nodes.push(ast);
+        while (!nodes.empty()) {
+            Node* n = nodes.top();
+            nodes.pop();
+            if (n->type == NodeType::ValRep) res = std::max(res, std::get<int>(n->val));
+            if (n->type == NodeType::BoundedRep) {
+                auto [min, max] = std::get<std::pair<int, int>>(n->val);
+                res = std::max(res, std::max(min, max));
+            }
+            for (Node* operand : n->operands) nodes.push(operand);
+        }
+        return res;
+    }
+
+    // number of capture groups, not counting the whole match
+    int get_groups_count() {
+        return this->nb_groups;
+    }
+
+    int get_peak_subset_size() {
+        return this->peak_subset_size;
+    }
+
     void print_syntax_tree() {
         std::vector<Node*> nodes;
         nodes.push_back(ast);
@@ -51,15 +123,25 @@ public:
                 case NodeType::BoundedRep: std::cout << "{" << std::get<std::pair<int, int>>(n->val).first << "," << std::get<std::pair<int, int>>(n->val).second << "} "; break;
                 case NodeType::CharSelect: 
                     std::cout << "[";
-                    for (char c : std::get<std::set<char>>(n->val)) std::cout << c;
+                    for (auto [lo, hi] : std::get<CharRanges>(n->val)) print_range(lo, hi);
                     std::cout << "] "; 
                     break;
                 case NodeType::CharExcl:
                     std::cout << "[^";
-                    for (char c : std::get<std::set<char>>(n->val)) std::cout << c;
+                    for (auto [lo, hi] : std::get<CharRanges>(n->val)) print_range(lo, hi);
                     std::cout << "] "; 
                     break;
-                case NodeType::Char: std::cout << std::get<char>(n->val) << " "; break;
+                case NodeType::Group: std::cout << "(" << std::get<int>(n->val) << ") "; break;
+                case NodeType::Char: std::cout << byte_to_string((unsigned char)std::get<char>(n->val)) << " "; break;
+                case NodeType::CodePointSelect:
+                    std::cout << "[";
+                    for (auto [lo, hi] : std::get<CharRanges>(n->val)) {
+                        std::cout << "U+" << std::hex << lo;
+                        if (hi > lo) std::cout << "-U+" << hi;
+                        std::cout << std::dec;
+                    }
+                    std::cout << "] ";
+                    break;
 
                 default:
                     break;
@@ -70,85 +152,191 @@ public:
         }
     }
 
-    void convert_to_determistic(DetAutomaton& d_automaton) {
-        std::set<std::set<int>> d_states;
-        std::set<int> d_start_state = nd_automaton.closure({nd_automaton.get_start_state()});
-
-        d_states.insert(d_start_state);
-        std::stack<std::set<int>> to_be_marked;
-        to_be_marked.push(d_start_state);
-        std::set<std::set<int>> marked;
-
-        std::map<std::set<int>, int> states_id_mapping;
-        states_id_mapping[d_start_state] = generate_uid();
+    // returns false when the deterministic automaton goes over the compile budget,
+    // the partially built automaton is cleared in that case
+    bool convert_to_determistic(DetAutomaton& d_automaton) {
+        SubsetConstruction construction(nd_automaton, options);
+        bool res = construction.run(d_automaton);
+        peak_subset_size = construction.get_peak_subset_size();
+        return res;
+    }
 
-        auto transition_table = nd_automaton.get_transition_table();
+private:
+    void print_range(int lo, int hi) {
+        std::cout << byte_to_string(lo);
+        if (hi > lo) std::cout << "-" << byte_to_string(hi);
+    }
 
-        d_automaton.clear();
-        while (!to_be_marked.empty()) {
-            std::set<int> t = to_be_marked.top();
-            to_be_marked.pop();
-            if (marked.find(t) != marked.end()) continue;
-            marked.insert(t);
-            std::map<char, std::set<int>> transitions;
-            for (int s1 : t) {
-                for (auto [c, states] : transition_table[s1]) {
-                    for (int s2 : states) {
-                        transitions[c].insert(s2);
+    // appends the strings matched by the tree to res
+    bool collect_literals(Node* n, std::vector<std::string>& res, int max_literals) {
+        switch (n->type)
+        {
+        case NodeType::Char:
+            res.push_back(std::string(1, std::get<char>(n->val)));
+            break;
+        case NodeType::CodePointSelect:
+            {
+                auto& ranges = std::get<CharRanges>(n->val);
+                if (ranges.size() != 1 || ranges[0].first != ranges[0].second) return false;
+                res.push_back(utf8_encode(ranges[0].first));
+            }
+            break;
+        case NodeType::Pipe:
+            for (Node* operand : n->operands) {
+                if (!collect_literals(operand, res, max_literals)) return false;
+            }
+            break;
+        case NodeType::Concat:
+            {
+                std::vector<std::string> product = {""};
+                for (Node* operand : n->operands) {
+                    std::vector<std::string> operand_literals;
+                    if (!collect_literals(operand, operand_literals, max_literals)) return false;
+                    if ((long long)product.size() * (long long)operand_literals.size() > max_literals) return false;
+                    // long literals are extended in place instead of being copied for every byte
+                    if (operand_literals.size() == 1) {
+                        for (std::string& prefix : product) prefix += operand_literals[0];
+                        continue;
+                    }
+                    std::vector<std::string> next;
+                    for (const std::string& prefix : product) {
+                        for (const std::string& suffix : operand_literals) next.push_back(prefix + suffix);
                     }
+                    product = next;
                 }
+                res.insert(res.end(), product.begin(), product.end());
             }
+            break;
+        default:
+            return false;
+        }
+        return (int)res.size() <= max_literals;
+    }
 
-            for (auto& [c, states] : transitions) {
-                states = nd_automaton.closure(states);
+    // appends the prefix matched by the tree, returns true when the whole tree is that prefix
+    bool collect_prefix(Node* n, std::string& res) {
+        switch (n->type)
+        {
+        case NodeType::Char:
+            res.push_back(std::get<char>(n->val));
+            return true;
+        case NodeType::CodePointSelect:
+            {
+                auto& ranges = std::get<CharRanges>(n->val);
+                if (ranges.size() != 1 || ranges[0].first != ranges[0].second) return false;
+                res += utf8_encode(ranges[0].first);
             }
-
-            int t_id = states_id_mapping[t];
-            for (auto [c, d_state] : transitions) {
-                if (c == EPSILON) continue;
-                if (states_id_mapping.find(d_state) == states_id_mapping.end()) states_id_mapping[d_state] = generate_uid();
-                d_automaton.add_transition(t_id, c, states_id_mapping[d_state]);
-                if (marked.find(d_state) != marked.end()) continue;
-                to_be_marked.push(d_state);
-                d_states.insert(d_state);
+            return true;
+        case NodeType::Concat:
+            for (Node* operand : n->operands) {
+                if (!collect_prefix(operand, res)) return false;
             }
+            return true;
+        case NodeType::Group:
+            return collect_prefix(n->operands[0], res);
+        case NodeType::PlusRep:
+            collect_prefix(n->operands[0], res);
+            return false;
+        case NodeType::ValRep:
+            if (std::get<int>(n->val) > 0) collect_prefix(n->operands[0], res);
+            return false;
+        case NodeType::BoundedRep:
+            if (std::get<std::pair<int, int>>(n->val).first > 0) collect_prefix(n->operands[0], res);
+            return false;
+        default:
+            return false;
         }
-        d_automaton.set_start_state(states_id_mapping[d_start_state]);
-        for (int fs : nd_automaton.get_end_states()) {
-            for (auto [state, id] : states_id_mapping) {
-                if (state.find(fs) != state.end()) d_automaton.add_end_state(id);
-            }
+    }
+
+    // the passes over the syntax tree recurse once per nested group or repetition, deeper
+    // trees would overflow the stack
+    void check_nesting(int depth) {
+        if (options.max_nesting > 0 && depth > options.max_nesting) {
+            throw RegexError(CompileStatus::BudgetExceeded, "groups and repetitions nested deeper than " + std::to_string(options.max_nesting) + " levels");
         }
     }
 
-private:
-    void fatal_error(std::string err) {
-        std::cout << "Regex parser error : " << err << std::endl;
-        exit(-1);
+    void check_tree_nesting() {
+        std::stack<std::pair<Node*, int>> nodes;
+        nodes.push({ast, 0});
+        while (!nodes.empty()) {
+            auto [n, depth] = nodes.top();
+            nodes.pop();
+            if (!n->operands.empty() && n->type != NodeType::Pipe && n->type != NodeType::Concat) check_nesting(++depth);
+            for (Node* operand : n->operands) nodes.push({operand, depth});
+        }
+    }
+
+    [[noreturn]] void fatal_error(std::string err) {
+        throw RegexError(CompileStatus::ParseError, "Regex parser error : " + err);
+    }
+
+    void check_nfa_budget() {
+        if (options.max_nfa_states > 0 && nd_automaton.get_states_count() > options.max_nfa_states) {
+            throw RegexError(CompileStatus::BudgetExceeded, "non deterministic automaton exceeds " + std::to_string(options.max_nfa_states) + " states");
+        }
+        long long memory = (long long)nd_automaton.get_states_count() * STATE_SET_OVERHEAD;
+        if (options.max_memory > 0 && memory > options.max_memory) {
+            throw RegexError(CompileStatus::BudgetExceeded, "non deterministic automaton exceeds the memory budget");
+        }
     }
 
-    char current() {
-        if (pos >= regexp.size()) return END_OF_INPUT;
-        char c1 = regexp[pos];
-        if (c1 != '\\') return c1;
-        if (pos + 1 >= regexp.size()) return END_OF_INPUT;
+    // returns the current token : a code point, an escaped literal flagged with ESCAPED,
+    // a raw byte flagged with RAW_BYTE or a character class
+    int current() {
+        curr_size = 0;
+        if (pos >= (int)regexp.size()) return END_OF_INPUT;
+        if (regexp[pos] != '\\') {
+            int cp = utf8_decode(regexp, pos, curr_size);
+            if (cp == -1) fatal_error("invalid UTF-8 sequence at " + std::to_string(pos));
+            return cp;
+        }
+        curr_size = 1;
+        if (pos + 1 >= (int)regexp.size()) return END_OF_INPUT;
         char c2 = regexp[pos + 1];
+        curr_size = 2;
         if (c2 == 'd') return DIGIT;
-        if (c2 == 'a') return ALPHANUM;
-        if (c2 == 'w') return ALPHA;
-        return c2 | 0x80;
+        if (c2 == 'w') return ALPHANUM;
+        if (c2 == 'a') return ALPHA;
+        if (c2 == 'x' || c2 == 'u') return parse_hex_escape();
+        int size;
+        int cp = utf8_decode(regexp, pos + 1, size);
+        if (cp == -1) fatal_error("invalid UTF-8 sequence at " + std::to_string(pos + 1));
+        curr_size = 1 + size;
+        return ESCAPED | cp;
+    }
+
+    // \xHH is a raw byte (a code point in utf8 mode), \uHHHH \u{H...} and \x{H...} are code points
+    int parse_hex_escape() {
+        int i = pos + 2;
+        bool braces = i < (int)regexp.size() && regexp[i] == '{';
+        if (braces) i++;
+        int max_digits = braces ? 6 : (regexp[pos + 1] == 'x' ? 2 : 4);
+        int value = 0;
+        int nb_digits = 0;
+        while (i < (int)regexp.size() && nb_digits < max_digits && isxdigit((unsigned char)regexp[i])) {
+            value = value * 16 + (isdigit((unsigned char)regexp[i]) ? regexp[i] - '0' : (tolower((unsigned char)regexp[i]) - 'a' + 10));
+            nb_digits++;
+            i++;
+        }
+        if (nb_digits == 0 || (!braces && nb_digits != max_digits)) fatal_error("invalid hexadecimal escape at " + std::to_string(pos));
+        if (braces) {
+            if (i >= (int)regexp.size() || regexp[i] != '}') fatal_error("expected } at " + std::to_string(i));
+            i++;
+        }
+        if (value > MAX_CODE_POINT || (value >= 0xD800 && value <= 0xDFFF)) fatal_error("invalid code point at " + std::to_string(pos));
+        curr_size = i - pos;
+        if (!braces && regexp[pos + 1] == 'x' && !options.utf8) return RAW_BYTE | value;
+        return ESCAPED | value;
     }
 
     void advance() {
-        if (pos >= regexp.size()) return;
-        pos++;
-        if (regexp[pos - 1] != '\\' || pos >= regexp.size()) return;
-        pos++;
+        pos += curr_size;
     }
 
-    void match(char c) {
+    void match(int c) {
         if (curr == END_OF_INPUT) fatal_error("Unexpected end");
-        if (curr != c) fatal_error(std::string("expected character ") + std::string(1, c) + " at " + std::to_string(pos));
+        if (curr != c) fatal_error(std::string("expected character ") + std::string(1, (char)c) + " at " + std::to_string(pos));
         advance();
         curr = current();
     }
@@ -158,19 +346,19 @@ private:
         return false;
     }
     
+    // the alternatives and the concatenated expressions are parsed in a loop, only groups
+    // make the parser recurse
     Node* parse_expr() {
         Node* left = this->parse_expr_wo_pipe();
-        if (is_at_expr_wo_pipe_end()) {
-            if (curr == END_OF_INPUT || curr == ')') return left;
+        if (!is_at_expr_wo_pipe_end()) fatal_error(std::string("error that shouldn\'t happen at ") + __FILE__ + ":" + std::to_string(__LINE__));
+        if (curr != '|') return left;
+        Node* pipe = new Node(NodeType::Pipe);
+        pipe->operands = {left};
+        while (curr == '|') {
             match('|');
-            Node* right = parse_expr();
-            Node* pipe = new Node(NodeType::Pipe);
-            pipe->operands = {left, right};
-            left = pipe;
-        } else if (curr != END_OF_INPUT) {
-            fatal_error(std::string("error that shouldn\'t happen at ") + __FILE__ + ":" + std::to_string(__LINE__));
+            pipe->operands.push_back(parse_expr_wo_pipe());
         }
-        return left;
+        return pipe;
     }
 
     bool is_at_expr_wo_concat_end() {
@@ -180,9 +368,9 @@ private:
     Node* parse_expr_wo_pipe() {
         Node* left = this->parse_expr_wo_concat();
         if (is_at_expr_wo_concat_end()) return left;
-        Node* right = this->parse_expr_wo_pipe();
         Node* concat = new Node(NodeType::Concat);
-        concat->operands = {left, right};
+        concat->operands = {left};
+        while (!is_at_expr_wo_concat_end()) concat->operands.push_back(parse_expr_wo_concat());
         return concat;
     }
 
@@ -213,15 +401,15 @@ private:
     Node* parse_unary_opr() {
         Node* node = nullptr;
         int num1, num2;
-        char op_char = curr;
+        int op_char = curr;
         switch (op_char)
         {
         case '+':
         case '?':
         case '*':
-            if (op_char == '+') node = new Node(NodeType::PlusRep, op_char);
-            else if (op_char == '*') node = new Node(NodeType::StarRep, op_char);
-            else if (op_char == '?') node = new Node(NodeType::OptRep, op_char);
+            if (op_char == '+') node = new Node(NodeType::PlusRep, '+');
+            else if (op_char == '*') node = new Node(NodeType::StarRep, '*');
+            else if (op_char == '?') node = new Node(NodeType::OptRep, '?');
             match(op_char);
             break;
         case '{':
@@ -232,6 +420,7 @@ private:
             } else {
                 match(',');
                 num2 = parse_num();
+                if (num1 > num2) fatal_error("invalid repetition bounds {" + std::to_string(num1) + "," + std::to_string(num2) + "} at " + std::to_string(pos));
                 node = new Node(NodeType::BoundedRep, std::make_pair(num1, num2));
             }
             match('}');
@@ -247,28 +436,71 @@ private:
         if (curr == END_OF_INPUT) fatal_error("Unexpected end");
         switch (curr)
         {
+        case ')':
+            fatal_error("unmatched ) at " + std::to_string(pos));
         case '(':
             match('(');
-            left = parse_expr();
+            check_nesting(++nesting);
+            if (curr == '?') {
+                // (?:expr) is a non capturing group
+                match('?');
+                match(':');
+                left = parse_expr();
+            } else {
+                Node* group = new Node(NodeType::Group, ++nb_groups);
+                group->operands = {parse_expr()};
+                left = group;
+            }
             match(')');
+            nesting--;
             break;
         case '[':
-            match('[');
-            if (curr == '^') {
-                match('^');
-                left = new Node(NodeType::CharExcl, parse_char_set());
-            } else left = new Node(NodeType::CharSelect, parse_char_set());
-            match(']');
+            {
+                match('[');
+                bool exclusion = curr == '^';
+                if (exclusion) match('^');
+                bool unicode = options.utf8;
+                CharRanges ranges = parse_char_set(unicode);
+                // the complement of a set closed under case folding is also closed
+                if (unicode) left = new Node(NodeType::CodePointSelect, exclusion ? complement_code_points(fold_code_points(ranges, options.case_folding)) : ranges);
+                else left = new Node(exclusion ? NodeType::CharExcl : NodeType::CharSelect, ranges);
+                match(']');
+            }
             break;
-        default:
-            if (curr & 0x80) left = new Node(NodeType::Char, (char)(curr & 0x7f));
-            else left = new Node(NodeType::Char, curr);
+        case '.':
+            if (options.utf8) left = new Node(NodeType::CodePointSelect, CharRanges{{0, MAX_CODE_POINT}});
+            else left = new Node(NodeType::CharSelect, CharRanges{{0, 255}});
             match(curr);
             break;
+        case DIGIT:
+        case ALPHA:
+        case ALPHANUM:
+            left = new Node(NodeType::CharSelect, class_ranges(curr));
+            match(curr);
+            break;
+        default:
+            {
+                int c = curr & ~ESCAPED;
+                if (c & RAW_BYTE) left = new Node(NodeType::Char, (char)(c & 0xff));
+                else if (c < 0x80) left = new Node(NodeType::Char, (char)c);
+                else left = new Node(NodeType::CodePointSelect, CharRanges{{c, c}});
+                match(curr);
+            }
+            break;
         }
         return left;
     }
 
+    CharRanges class_ranges(int c) {
+        if (c == DIGIT) return {{'0', '9'}};
+        if (c == ALPHA) return {{'A', 'Z'}, {'a', 'z'}};
+        return {{'0', '9'}, {'A', 'Z'}, {'_', '_'}, {'a', 'z'}};
+    }
+
+    bool is_class(int c) {
+        return c == DIGIT || c == ALPHA || c == ALPHANUM;
+    }
+
     bool is_at_2nd_num() {
         if (curr == END_OF_INPUT) return false;
         return curr == ',';
@@ -288,98 +520,195 @@ private:
             match(curr);
         }
         skip_white_spaces();
+        if (str.empty()) fatal_error("expected number at " + std::to_string(pos));
+        if (str.size() > 9) fatal_error("repetition count too large at " + std::to_string(pos));
         return std::stoi(str);
     }
 
-    std::set<char> parse_char_set() {
-        std::set<char> res;
+    // value of a literal token inside a set, a non ASCII code point turns the set into a code points set
+    int char_set_item(bool& unicode) {
+        int c = curr & ~ESCAPED;
+        if (c & RAW_BYTE) return c & 0xff;
+        if (c >= 0x80) unicode = true;
+        return c;
+    }
+
+    // char_set -> char | char-char | char char_set | char-char char_set
+    // the ranges are bytes unless the set contains a non ASCII character, raw bytes
+    // are read as code points in a code points set
+    CharRanges parse_char_set(bool& unicode) {
+        CharRanges res;
         while (curr != END_OF_INPUT && curr != ']') {
-            res.insert(curr);
+            if (is_class(curr)) {
+                for (auto range : class_ranges(curr)) res.push_back(range);
+                match(curr);
+                continue;
+            }
+            int lo = char_set_item(unicode);
+            match(curr);
+            if (curr != '-') {
+                res.push_back({lo, lo});
+                continue;
+            }
+            match('-');
+            if (curr == ']') {
+                res.push_back({lo, lo});
+                res.push_back({'-', '-'});
+                continue;
+            }
+            if (curr == END_OF_INPUT || is_class(curr)) fatal_error("invalid range end at " + std::to_string(pos));
+            int hi = char_set_item(unicode);
+            if (hi < lo) fatal_error("invalid range at " + std::to_string(pos));
+            res.push_back({lo, hi});
             match(curr);
         }
+        return normalize_ranges(res);
+    }
+
+    CharSet to_char_set(const CharRanges& ranges) {
+        CharSet res;
+        for (auto [lo, hi] : ranges) {
+            for (int c = lo; c <= hi; ++c) res.set(c);
+        }
         return res;
     }
 
+
+    // bytes are folded as ASCII in every case folding mode, the other bytes are raw bytes
+    // or parts of UTF-8 sequences
+    CharSet fold(const CharSet& chars) {
+        if (options.case_folding == CaseFolding::CaseSensitive) return chars;
+        return fold_ascii_bytes(chars);
+    }
+
+    CharSet char_set(char c) {
+        return fold(CharSet().set((unsigned char)c));
+    }
+
     // return the start & end of the sub tree
     std::pair<int, int> convert_ast2nda(Node* n) {
         switch (n->type)
         {
         case NodeType::Pipe:
             {
-                auto [left_start, left_end] = convert_ast2nda(n->operands[0]);
-                auto [right_start, right_end] = convert_ast2nda(n->operands[1]);
                 int start = generate_uid();
                 int end = generate_uid();
-                this->nd_automaton.add_transition(start, EPSILON, left_start);
-                this->nd_automaton.add_transition(start, EPSILON, right_start);
-                this->nd_automaton.add_transition(left_end, EPSILON, end);
-                this->nd_automaton.add_transition(right_end, EPSILON, end);
+                for (Node* operand : n->operands) {
+                    auto [operand_start, operand_end] = convert_ast2nda(operand);
+                    this->nd_automaton.add_transition(start, EPSILON, operand_start);
+                    this->nd_automaton.add_transition(operand_end, EPSILON, end);
+                }
                 return {start, end};
             }
             break;
         case NodeType::Concat:
             {
-                auto [left_start, left_end] = convert_ast2nda(n->operands[0]);
-                auto [right_start, right_end] = convert_ast2nda(n->operands[1]);
-                int start = left_start;
-                int end = right_end;
-                this->nd_automaton.add_transition(left_end, EPSILON, right_start);
+                int start = -1;
+                int end = -1;
+                for (int i = 0; i < (int)n->operands.size(); ++i) {
+                    // runs of literals share their states instead of being linked by epsilon transitions
+                    int operand_start, operand_end;
+                    if (n->operands[i]->type == NodeType::Char) {
+                        operand_start = generate_uid();
+                        operand_end = operand_start;
+                        for (; i < (int)n->operands.size() && n->operands[i]->type == NodeType::Char; ++i) {
+                            int next = generate_uid();
+                            this->nd_automaton.add_transition(operand_end, char_set(std::get<char>(n->operands[i]->val)), next);
+                            operand_end = next;
+                        }
+                        --i;
+                    } else {
+                        std::tie(operand_start, operand_end) = convert_ast2nda(n->operands[i]);
+                    }
+                    if (start == -1) start = operand_start;
+                    else this->nd_automaton.add_transition(end, EPSILON, operand_start);
+                    end = operand_end;
+                }
                 return {start, end};
             }
             break;
-        case NodeType::StarRep: 
+        case NodeType::Group:
             {
-                auto [start, end] = convert_ast2nda(n->operands[0]);
-                this->nd_automaton.add_transition(start, EPSILON, end);
-                this->nd_automaton.add_transition(end, EPSILON, start);
+                // the tagged states are kept inside the group, repetitions add their
+                // epsilon transitions between start and end and must not go through them
+                int group = std::get<int>(n->val);
+                int start = generate_uid();
+                int open = generate_uid();
+                int close = generate_uid();
+                int end = generate_uid();
+                auto [operand_start, operand_end] = convert_ast2nda(n->operands[0]);
+                this->nd_automaton.add_transition(start, EPSILON, open);
+                this->nd_automaton.add_transition(open, EPSILON, operand_start);
+                this->nd_automaton.add_transition(operand_end, EPSILON, close);
+                this->nd_automaton.add_transition(close, EPSILON, end);
+                this->nd_automaton.set_state_tag(open, 2 * group);
+                this->nd_automaton.set_state_tag(close, 2 * group + 1);
                 return {start, end};
             }
             break;
+        case NodeType::StarRep:
         case NodeType::OptRep:
-            {
-                auto [start, end] = convert_ast2nda(n->operands[0]);
-                this->nd_automaton.add_transition(start, EPSILON, end);
-                return {start, end};
-            }
-            break;
         case NodeType::PlusRep:
             {
-                auto [start, end] = convert_ast2nda(n->operands[0]);
-                this->nd_automaton.add_transition(end, EPSILON, start);
+                // the operand is wrapped in its own start and end states, adding the skip and
+                // loop transitions on the states of the operand would chain them with those of
+                // a nested repetition, (aa+)? would then accept "a". the operand transitions
+                // are added first so that the repetitions are greedy
+                int start = generate_uid();
+                int end = generate_uid();
+                auto [operand_start, operand_end] = convert_ast2nda(n->operands[0]);
+                this->nd_automaton.add_transition(start, EPSILON, operand_start);
+                if (n->type != NodeType::PlusRep) this->nd_automaton.add_transition(start, EPSILON, end);
+                if (n->type != NodeType::OptRep) this->nd_automaton.add_transition(operand_end, EPSILON, operand_start);
+                this->nd_automaton.add_transition(operand_end, EPSILON, end);
                 return {start, end};
             }
             break;
         case NodeType::ValRep:
             {
                 int num = std::get<int>(n->val);
+                if (num == 0) {
+                    // x{0} only matches the empty string
+                    int s = generate_uid();
+                    return {s, s};
+                }
                 auto [start, end] = convert_ast2nda(n->operands[0]);
-                if (num == 0) this->nd_automaton.add_transition(start, EPSILON, end);
-                int endi = end;
+                // copies are made before chaining them, copying a chained automaton
+                // would also copy the previous copies
+                std::vector<std::pair<int, int>> chaining = {{start, end}};
                 for (int i = 1; i < num; ++i) {
+                    check_nfa_budget();
                     auto [starti, end_set] = this->nd_automaton.copy_automaton_inplace(start, {end});
-                    this->nd_automaton.add_transition(endi, EPSILON, starti);
-                    endi = *end_set.begin();
+                    chaining.push_back({starti, *end_set.begin()});
                 }
-                return {start, endi};
+                for (int i = 1; i < (int)chaining.size(); ++i) {
+                    this->nd_automaton.add_transition(chaining[i - 1].second, EPSILON, chaining[i].first);
+                }
+                return {start, chaining.back().second};
             }
             break;
         case NodeType::BoundedRep:
             {
                 {
                     auto [num1, num2] = std::get<std::pair<int, int>>(n->val);
+                    if (num2 == 0) {
+                        int s = generate_uid();
+                        return {s, s};
+                    }
                     std::vector<std::pair<int, int>> chaining;
                     auto [start, end] = convert_ast2nda(n->operands[0]);
-                    if (num1 == 0) this->nd_automaton.add_transition(start, EPSILON, end);
                     chaining.push_back({start, end});
                     for (int i = 1; i < num2; ++i) {
+                        check_nfa_budget();
                         auto [starti, end_set] = this->nd_automaton.copy_automaton_inplace(start, {end});
-                        int endi = *end_set.begin();
-                        int last_end = chaining.back().second;
-                        this->nd_automaton.add_transition(last_end, EPSILON, starti);
-                        chaining.push_back({starti, endi});
+                        chaining.push_back({starti, *end_set.begin()});
+                    }
+                    if (num1 == 0) this->nd_automaton.add_transition(start, EPSILON, end);
+                    for (int i = 1; i < (int)chaining.size(); ++i) {
+                        this->nd_automaton.add_transition(chaining[i - 1].second, EPSILON, chaining[i].first);
                     }
                     end = chaining.back().second;
-                    for (int i = num1 - 1; i < chaining.size() - 1; ++i) {
+                    for (int i = std::max(num1 - 1, 0); i < (int)chaining.size() - 1; ++i) {
                         this->nd_automaton.add_transition(chaining[i].second, EPSILON, end);
                     }
                     return {start, end};
@@ -391,59 +720,56 @@ private:
             {
                 int start = generate_uid();
                 int end = generate_uid();
-                for (char c : std::get<std::set<char>>(n->val)) {
-                    this->nd_automaton.add_transition(start, c, end);
-                }
+                this->nd_automaton.add_transition(start, fold(to_char_set(std::get<CharRanges>(n->val))), end);
                 return {start, end};
             }
             break;
         case NodeType::CharExcl:
             {
                 int start = generate_uid();
-                int dead_state = generate_uid();
                 int end = generate_uid();
-                std::set<char> char_set = std::get<std::set<char>>(n->val);
-                for (char c : char_set) {
-                    nd_automaton.add_transition(start, c, dead_state);
-                }
-                nd_automaton.add_transition(start, MATCH_OTHERS, end);
+                this->nd_automaton.add_transition(start, ~fold(to_char_set(std::get<CharRanges>(n->val))), end);
                 return {start, end};
             }
-        case NodeType::Char:
+            break;
+        case NodeType::CodePointSelect:
             {
+                // every code points range is split into sequences of byte ranges, sequences
+                // sharing a suffix (the continuation bytes) share the states matching it
                 int start = generate_uid();
                 int end = generate_uid();
-                char c = std::get<char>(n->val);
-                if (c == DIGIT) {
-                    for (char c2 = '0'; c2 <= '9'; ++c2) {
-                        this->nd_automaton.add_transition(start, c2, end);
-                    }
-                } else if (c == ALPHANUM) {
-                    for (char c2 = '0'; c2 <= '9'; ++c2) {
-                        this->nd_automaton.add_transition(start, c2, end);
-                    }
-                    for (char c2 = 'a'; c2 <= 'z'; ++c2) {
-                        this->nd_automaton.add_transition(start, c2, end);
-                    }
-                    for (char c2 = 'A'; c2 <= 'Z'; ++c2) {
-                        this->nd_automaton.add_transition(start, c2, end);
-                    }
-                    this->nd_automaton.add_transition(start, '_', end);
-                } else if (c == ALPHA) {
-                    for (char c2 = 'a'; c2 <= 'z'; ++c2) {
-                        this->nd_automaton.add_transition(start, c2, end);
+                std::map<CharRanges, int> suffix_states;
+                for (auto [lo, hi] : fold_code_points(std::get<CharRanges>(n->val), options.case_folding)) {
+                    std::vector<CharRanges> sequences;
+                    utf8_sequences(lo, hi, sequences);
+                    for (const CharRanges& sequence : sequences) {
+                        int next = end;
+                        for (int i = (int)sequence.size() - 1; i >= 1; --i) {
+                            CharRanges suffix(sequence.begin() + i, sequence.end());
+                            auto it = suffix_states.find(suffix);
+                            if (it != suffix_states.end()) {
+                                next = it->second;
+                                continue;
+                            }
+                            int s = generate_uid();
+                            this->nd_automaton.add_transition(s, to_char_set({sequence[i]}), next);
+                            suffix_states[suffix] = s;
+                            next = s;
+                        }
+                        this->nd_automaton.add_transition(start, to_char_set({sequence[0]}), next);
                     }
-                    for (char c2 = 'A'; c2 <= 'Z'; ++c2) {
-                        this->nd_automaton.add_transition(start, c2, end);
-                    }
-                } else if (c & 0x80) {
-                    this->nd_automaton.add_transition(start, c & 0x7f + 1, end);
-                } else {
-                    this->nd_automaton.add_transition(start, c, end);
                 }
                 return {start, end};
             }
             break;
+        case NodeType::Char:
+            {
+                int start = generate_uid();
+                int end = generate_uid();
+                this->nd_automaton.add_transition(start, char_set(std::get<char>(n->val)), end);
+                return {start, end};
+            }
+            break;
         
         default:
             break;
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <vector>
+#include <set>
+#include <map>
+#include <stack>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "NDetAutomaton.hpp"
+#include "DetAutomaton.hpp"
+#include "CompileOptions.hpp"
+#include "CompileStats.hpp"
+
+// converts a non deterministic automaton to a deterministic one, the tag of an end state of the
+// deterministic automaton is the smallest tag of the non deterministic end states it contains.
+// with several threads the states of each depth are split between the threads and the states
+// are renumbered in breadth first order at the end, so the result doesn't depend on scheduling
+class SubsetConstruction {
+private:
+    NDetAutomaton& nd_automaton;
+    std::set<int> end_states;
+    CompileOptions options;
+    int peak_subset_size = 0;
+
+    struct SubsetHash {
+        size_t operator()(const std::vector<int>& subset) const {
+            size_t h = 14695981039346656037ULL;
+            for (int s : subset) h = (h ^ (unsigned int)s) * 1099511628211ULL;
+            return h;
+        }
+    };
+
+    // subsets are interned in shards with their own lock, the keys of an unordered_map
+    // don't move so the workers keep pointers to them
+    static const int NB_SHARDS = 64;
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::vector<int>, int, SubsetHash> ids;
+    };
+
+    struct Edge {
+        int from;
+        int byte_class;
+        int to;
+    };
+
+    // two closures with the same states having labeled transitions and the same end states
+    // behave the same, the other states are dropped from the subsets
+    std::set<int> kernel(const std::set<int>& closure) {
+        const auto& transition_table = nd_automaton.get_transition_table();
+        std::set<int> res;
+        for (int s : closure) {
+            auto it = transition_table.find(s);
+            if ((it != transition_table.end() && !it->second.empty()) || end_states.find(s) != end_states.end()) res.insert(res.end(), s);
+        }
+        return res;
+    }
+
+    bool run_parallel(DetAutomaton& d_automaton, int nb_threads) {
+        auto start_time = CompileStats::clock::now();
+        const auto& transition_table = nd_automaton.get_transition_table();
+        std::vector<int> byte_classes = nd_automaton.get_byte_classes();
+        int nb_classes = *std::max_element(byte_classes.begin(), byte_classes.end()) + 1;
+        std::vector<int> representative(nb_classes);
+        std::vector<CharSet> class_chars(nb_classes);
+        for (int c = 255; c >= 0; --c) {
+            representative[byte_classes[c]] = c;
+            class_chars[byte_classes[c]].set(c);
+        }
+
+        std::vector<Shard> shards(NB_SHARDS);
+        std::atomic<int> nb_states(0);
+        std::atomic<long long> memory(0);
+        std::atomic<bool> failed(false);
+        std::atomic<int> closure_calls(0);
+        std::vector<const std::vector<int>*> subsets;
+        std::vector<std::vector<Edge>> edges(nb_threads);
+        std::vector<int> peak_sizes(nb_threads, 0);
+
+        // returns the id of the subset and whether it was added
+        auto intern = [&](std::vector<int>& subset, const std::vector<int>*& key) {
+            Shard& shard = shards[SubsetHash()(subset) % NB_SHARDS];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto [it, inserted] = shard.ids.try_emplace(std::move(subset), 0);
+            if (inserted) it->second = nb_states++;
+            key = &it->first;
+            return std::make_pair(it->second, inserted);
+        };
+
+        std::set<int> start_set = kernel(nd_automaton.closure({nd_automaton.get_start_state()}));
+        std::vector<int> start_subset(start_set.begin(), start_set.end());
+        const std::vector<int>* start_key;
+        intern(start_subset, start_key);
+        std::vector<std::pair<int, const std::vector<int>*>> frontier = {{0, start_key}};
+        subsets.push_back(start_key);
+
+        while (!frontier.empty() && !failed) {
+            std::atomic<size_t> next_item(0);
+            std::vector<std::vector<std::pair<int, const std::vector<int>*>>> next_frontiers(nb_threads);
+            auto worker = [&](int w) {
+                std::vector<std::set<int>> transitions(nb_classes);
+                int calls = 0;
+                for (size_t i = next_item++; i < frontier.size() && !failed; i = next_item++) {
+                    auto [t_id, t] = frontier[i];
+                    peak_sizes[w] = std::max(peak_sizes[w], (int)t->size());
+                    if (options.max_time > 0 && CompileStats::elapsed_ms(start_time, CompileStats::clock::now()) > options.max_time) {
+                        failed = true;
+                        break;
+                    }
+                    for (std::set<int>& states : transitions) states.clear();
+                    for (int s1 : *t) {
+                        auto it = transition_table.find(s1);
+                        if (it == transition_table.end()) continue;
+                        for (auto& [label, s2] : it->second) {
+                            for (int k = 0; k < nb_classes; ++k) {
+                                if (label[representative[k]]) transitions[k].insert(s2);
+                            }
+                        }
+                    }
+                    for (int k = 0; k < nb_classes; ++k) {
+                        if (transitions[k].empty()) continue;
+                        std::set<int> d_set = kernel(nd_automaton.epsilon_closure(transitions[k]));
+                        calls++;
+                        std::vector<int> d_state(d_set.begin(), d_set.end());
+                        long long size = (long long)d_state.size();
+                        const std::vector<int>* key;
+                        auto [id, inserted] = intern(d_state, key);
+                        if (inserted) {
+                            next_frontiers[w].push_back({id, key});
+                            memory += 2 * (STATE_SET_OVERHEAD + size * STATE_SET_ENTRY_SIZE) + STATE_SET_OVERHEAD + nb_classes * TRANSITION_SIZE;
+                        }
+                        edges[w].push_back({t_id, k, id});
+                        if ((options.max_dfa_states > 0 && nb_states > options.max_dfa_states) ||
+                            (options.max_memory > 0 && memory > options.max_memory)) {
+                            failed = true;
+                            break;
+                        }
+                    }
+                }
+                closure_calls += calls;
+            };
+            // small frontiers aren't worth starting threads
+            int nb_workers = std::min(nb_threads, (int)frontier.size());
+            std::vector<std::thread> threads;
+            for (int w = 1; w < nb_workers; ++w) threads.emplace_back(worker, w);
+            worker(0);
+            for (std::thread& thread : threads) thread.join();
+
+            frontier.clear();
+            subsets.resize(nb_states);
+            for (auto& next : next_frontiers) {
+                for (auto& [id, key] : next) {
+                    frontier.push_back({id, key});
+                    subsets[id] = key;
+                }
+            }
+        }
+        nd_automaton.add_closure_calls(closure_calls);
+        peak_subset_size = *std::max_element(peak_sizes.begin(), peak_sizes.end());
+        if (failed) {
+            d_automaton.clear();
+            return false;
+        }
+
+        // canonical numbering : breadth first order from the start state, successors by byte class
+        std::vector<std::vector<std::pair<int, int>>> successors(nb_states);
+        for (auto& worker_edges : edges) {
+            for (const Edge& edge : worker_edges) successors[edge.from].push_back({edge.byte_class, edge.to});
+        }
+        std::vector<int> order = {0};
+        std::vector<int> ids(nb_states, -1);
+        ids[0] = generate_uid();
+        for (int i = 0; i < (int)order.size(); ++i) {
+            std::sort(successors[order[i]].begin(), successors[order[i]].end());
+            for (auto [k, to] : successors[order[i]]) {
+                if (ids[to] != -1) continue;
+                ids[to] = generate_uid();
+                order.push_back(to);
+            }
+        }
+        d_automaton.clear();
+        for (int from : order) {
+            for (auto [k, to] : successors[from]) d_automaton.add_transition(ids[from], class_chars[k], ids[to]);
+        }
+        d_automaton.set_start_state(ids[0]);
+        for (int from : order) {
+            for (int s : *subsets[from]) {
+                if (end_states.find(s) != end_states.end()) d_automaton.add_end_state(ids[from], nd_automaton.get_end_tag(s));
+            }
+        }
+        return true;
+    }
+public:
+    SubsetConstruction(NDetAutomaton& t_nd_automaton, CompileOptions t_options = CompileOptions()) : nd_automaton(t_nd_automaton), end_states(t_nd_automaton.get_end_states()), options(t_options) { }
+
+    int get_peak_subset_size() {
+        return this->peak_subset_size;
+    }
+
+    // returns false when the deterministic automaton goes over the compile budget,
+    // the partially built automaton is cleared in that case
+    bool run(DetAutomaton& d_automaton) {
+        int nb_threads = options.threads > 0 ? options.threads : (int)std::thread::hardware_concurrency();
+        if (nb_threads > 1) return run_parallel(d_automaton, nb_threads);
+        auto start_time = CompileStats::clock::now();
+        long long memory = 0;
+        std::set<int> d_start_state = kernel(nd_automaton.closure({nd_automaton.get_start_state()}));
+
+        std::stack<std::set<int>> to_be_marked;
+        to_be_marked.push(d_start_state);
+
+        std::map<std::set<int>, int> states_id_mapping;
+        states_id_mapping[d_start_state] = generate_uid();
+
+        const auto& transition_table = nd_automaton.get_transition_table();
+        std::vector<int> byte_classes = nd_automaton.get_byte_classes();
+        int nb_classes = *std::max_element(byte_classes.begin(), byte_classes.end()) + 1;
+        std::vector<int> representative(nb_classes);
+        std::vector<CharSet> class_chars(nb_classes);
+        for (int c = 255; c >= 0; --c) {
+            representative[byte_classes[c]] = c;
+            class_chars[byte_classes[c]].set(c);
+        }
+
+        d_automaton.clear();
+        peak_subset_size = 0;
+        while (!to_be_marked.empty()) {
+            std::set<int> t = to_be_marked.top();
+            to_be_marked.pop();
+            peak_subset_size = std::max(peak_subset_size, (int)t.size());
+            if (options.max_time > 0 && CompileStats::elapsed_ms(start_time, CompileStats::clock::now()) > options.max_time) {
+                d_automaton.clear();
+                return false;
+            }
+            std::vector<std::set<int>> transitions(nb_classes);
+            for (int s1 : t) {
+                auto it = transition_table.find(s1);
+                if (it == transition_table.end()) continue;
+                for (auto& [label, s2] : it->second) {
+                    for (int k = 0; k < nb_classes; ++k) {
+                        if (label[representative[k]]) transitions[k].insert(s2);
+                    }
+                }
+            }
+
+            int t_id = states_id_mapping[t];
+            for (int k = 0; k < nb_classes; ++k) {
+                if (transitions[k].empty()) continue;
+                std::set<int> d_state = kernel(nd_automaton.closure(transitions[k]));
+                if (states_id_mapping.find(d_state) == states_id_mapping.end()) {
+                    states_id_mapping[d_state] = generate_uid();
+                    to_be_marked.push(d_state);
+                    // the subset is stored in the id mapping and the stack, the state gets a row
+                    memory += 2 * (STATE_SET_OVERHEAD + (long long)d_state.size() * STATE_SET_ENTRY_SIZE) + STATE_SET_OVERHEAD + nb_classes * TRANSITION_SIZE;
+                }
+                d_automaton.add_transition(t_id, class_chars[k], states_id_mapping[d_state]);
+                if (options.max_dfa_states > 0 && (int)states_id_mapping.size() > options.max_dfa_states) {
+                    d_automaton.clear();
+                    return false;
+                }
+                if (options.max_memory > 0 && memory > options.max_memory) {
+                    d_automaton.clear();
+                    return false;
+                }
+            }
+        }
+        d_automaton.set_start_state(states_id_mapping[d_start_state]);
+        for (auto& [state, id] : states_id_mapping) {
+            for (int s : state) {
+                if (end_states.find(s) != end_states.end()) d_automaton.add_end_state(id, nd_automaton.get_end_tag(s));
+            }
+        }
+        return true;
+    }
+};
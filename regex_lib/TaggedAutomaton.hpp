@@ -0,0 +1,278 @@
+#pragma once
+
+#include <vector>
+#include <set>
+#include <map>
+#include <string>
+#include <algorithm>
+
+#include "NDetAutomaton.hpp"
+
+// matches a regex with capture groups without backtracking, the capture slots are tags
+// saved on the states of the non deterministic automaton. when no input can reach a state
+// with two different sets of tags the automaton is compiled to a one pass deterministic
+// automaton that applies the tags on its transitions, otherwise the tagged automaton is
+// simulated with one thread per state (pike vm), both run in O(n) per input character
+class TaggedAutomaton {
+private:
+    struct Step {
+        int target;
+        int actions; // index in action_lists
+    };
+
+    int nb_slots = 2;
+    bool built = false;
+    bool one_pass = true;
+
+    // compact copy of the non deterministic automaton
+    int nb_states = 0;
+    int start = -1;
+    std::vector<std::vector<std::pair<CharSet, int>>> edges;
+    std::vector<std::vector<int>> epsilon_edges;
+    std::vector<int> tags;
+    std::vector<bool> is_end;
+
+    // one pass automaton, states are the kernel states of the tagged automaton
+    int op_start = -1;
+    std::vector<Step> op_table; // 256 entries per state, target -1 without transition
+    std::vector<int> op_accept; // actions applied when accepting, -1 for non accepting states
+    std::vector<std::vector<int>> action_lists;
+
+    // pike vm buffers, allocated once
+    struct ThreadList {
+        std::vector<int> dense;
+        std::vector<int> sparse;
+        std::vector<int> slots;
+        int size = 0;
+    };
+    ThreadList clist, nlist;
+    struct StackEntry {
+        int state;
+        int slot; // slot to restore when state is -1
+        int value;
+    };
+    std::vector<StackEntry> stack;
+    std::vector<int> scratch;
+    // slots of the last match, returned by get_slots()
+    std::vector<int> best;
+
+    int intern_actions(const std::vector<int>& actions) {
+        for (int i = 0; i < (int)action_lists.size(); ++i) {
+            if (action_lists[i] == actions) return i;
+        }
+        action_lists.push_back(actions);
+        return (int)action_lists.size() - 1;
+    }
+
+    // follows the epsilon transitions of a kernel state and records the tags of the path
+    // reaching each state, fails when a state can be reached with different tags
+    bool kernel_closure(int kernel, std::vector<std::pair<int, std::vector<int>>>& reached) {
+        std::map<int, std::vector<int>> paths;
+        std::vector<int> to_visit = {kernel};
+        paths[kernel] = tags[kernel] != -1 ? std::vector<int>{tags[kernel]} : std::vector<int>();
+        while (!to_visit.empty()) {
+            int s = to_visit.back();
+            to_visit.pop_back();
+            reached.push_back({s, paths[s]});
+            for (int t : epsilon_edges[s]) {
+                std::vector<int> path = paths[s];
+                if (tags[t] != -1) {
+                    path.push_back(tags[t]);
+                    std::sort(path.begin(), path.end());
+                    path.erase(std::unique(path.begin(), path.end()), path.end());
+                }
+                auto it = paths.find(t);
+                if (it == paths.end()) {
+                    paths[t] = path;
+                    to_visit.push_back(t);
+                } else if (it->second != path) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool build_one_pass() {
+        std::map<int, int> kernel_ids;
+        std::vector<int> kernels = {start};
+        kernel_ids[start] = 0;
+        action_lists.clear();
+        for (int k = 0; k < (int)kernels.size(); ++k) {
+            std::vector<std::pair<int, std::vector<int>>> reached;
+            if (!kernel_closure(kernels[k], reached)) return false;
+            op_table.resize(kernels.size() * 256, {-1, -1});
+            op_accept.push_back(-1);
+            for (auto& [s, path] : reached) {
+                if (is_end[s]) {
+                    int actions = intern_actions(path);
+                    if (op_accept[k] != -1 && op_accept[k] != actions) return false;
+                    op_accept[k] = actions;
+                }
+                for (auto& [label, t] : edges[s]) {
+                    if (kernel_ids.find(t) == kernel_ids.end()) {
+                        kernel_ids[t] = (int)kernels.size();
+                        kernels.push_back(t);
+                    }
+                    Step step = {kernel_ids[t], intern_actions(path)};
+                    for (int c = 0; c < 256; ++c) {
+                        if (!label[c]) continue;
+                        Step& entry = op_table[k * 256 + c];
+                        if (entry.target != -1 && (entry.target != step.target || entry.actions != step.actions)) return false;
+                        entry = step;
+                    }
+                }
+            }
+        }
+        op_start = 0;
+        return true;
+    }
+
+    void clear_list(ThreadList& list) {
+        list.size = 0;
+    }
+
+    bool contains(ThreadList& list, int s) {
+        int i = list.sparse[s];
+        return i < list.size && list.dense[i] == s;
+    }
+
+    // adds the thread and every thread reachable by epsilon transitions, scratch holds the
+    // slots of the thread and is restored on return
+    void add_thread(ThreadList& list, int s0, int pos) {
+        stack.clear();
+        stack.push_back({s0, -1, 0});
+        while (!stack.empty()) {
+            StackEntry entry = stack.back();
+            stack.pop_back();
+            if (entry.state == -1) {
+                scratch[entry.slot] = entry.value;
+                continue;
+            }
+            int s = entry.state;
+            if (contains(list, s)) continue;
+            list.sparse[s] = list.size;
+            list.dense[list.size] = s;
+            if (tags[s] != -1) {
+                stack.push_back({-1, tags[s], scratch[tags[s]]});
+                scratch[tags[s]] = pos;
+            }
+            std::copy(scratch.begin(), scratch.end(), list.slots.begin() + (size_t)list.size * nb_slots);
+            list.size++;
+            for (auto it = epsilon_edges[s].rbegin(); it != epsilon_edges[s].rend(); ++it) stack.push_back({*it, -1, 0});
+        }
+    }
+
+    int match_one_pass(const std::string& str, int offset) {
+        int matched = -1;
+        int s = op_start;
+        std::fill(scratch.begin(), scratch.end(), -1);
+        for (int pos = offset; ; ++pos) {
+            if (op_accept[s] != -1) {
+                matched = pos;
+                std::copy(scratch.begin(), scratch.end(), best.begin());
+                for (int slot : action_lists[op_accept[s]]) best[slot] = pos;
+            }
+            if (pos >= (int)str.size()) break;
+            const Step& step = op_table[s * 256 + (unsigned char)str[pos]];
+            if (step.target == -1) break;
+            for (int slot : action_lists[step.actions]) scratch[slot] = pos;
+            s = step.target;
+        }
+        return matched;
+    }
+
+    int match_pike(const std::string& str, int offset) {
+        int matched = -1;
+        clear_list(clist);
+        std::fill(scratch.begin(), scratch.end(), -1);
+        add_thread(clist, start, offset);
+        for (int pos = offset; clist.size > 0; ++pos) {
+            clear_list(nlist);
+            // threads are ordered by priority, the first accepting one gives the submatches
+            bool accepted = false;
+            for (int i = 0; i < clist.size; ++i) {
+                int s = clist.dense[i];
+                const int* thread_slots = &clist.slots[(size_t)i * nb_slots];
+                if (is_end[s] && !accepted) {
+                    accepted = true;
+                    matched = pos;
+                    std::copy(thread_slots, thread_slots + nb_slots, best.begin());
+                }
+                if (pos >= (int)str.size()) continue;
+                unsigned char c = str[pos];
+                for (auto& [label, t] : edges[s]) {
+                    if (!label[c]) continue;
+                    std::copy(thread_slots, thread_slots + nb_slots, scratch.begin());
+                    add_thread(nlist, t, pos + 1);
+                }
+            }
+            if (pos >= (int)str.size()) break;
+            std::swap(clist, nlist);
+        }
+        return matched;
+    }
+
+public:
+    TaggedAutomaton() { }
+
+    bool is_built() {
+        return this->built;
+    }
+
+    bool is_one_pass() {
+        return this->one_pass;
+    }
+
+    void build(NDetAutomaton& nd_automaton, int nb_groups) {
+        nb_slots = 2 * (nb_groups + 1);
+        std::map<int, int> ids;
+        for (int s : nd_automaton.get_states()) ids[s] = nb_states++;
+        if (ids.find(nd_automaton.get_start_state()) == ids.end()) ids[nd_automaton.get_start_state()] = nb_states++;
+        edges.assign(nb_states, {});
+        epsilon_edges.assign(nb_states, {});
+        tags.assign(nb_states, -1);
+        is_end.assign(nb_states, false);
+        for (auto& [s, id] : ids) tags[id] = nd_automaton.get_state_tag(s);
+        for (auto& [s1, s_edges] : nd_automaton.get_transition_table()) {
+            for (auto& [label, s2] : s_edges) edges[ids[s1]].push_back({label, ids[s2]});
+        }
+        for (auto& [s1, states] : nd_automaton.get_epsilon_table()) {
+            for (int s2 : states) epsilon_edges[ids[s1]].push_back(ids[s2]);
+        }
+        for (int s : nd_automaton.get_end_states()) is_end[ids[s]] = true;
+        start = ids[nd_automaton.get_start_state()];
+
+        one_pass = build_one_pass();
+        if (!one_pass) {
+            op_table.clear();
+            op_accept.clear();
+            action_lists.clear();
+            for (ThreadList* list : {&clist, &nlist}) {
+                list->dense.assign(nb_states, 0);
+                list->sparse.assign(nb_states, 0);
+                list->slots.assign((size_t)nb_states * nb_slots, -1);
+            }
+            stack.reserve(2 * nb_states);
+        }
+        scratch.assign(nb_slots, -1);
+        best.assign(nb_slots, -1);
+        built = true;
+    }
+
+    // longest match starting at offset, get_slots() then returns the start and end offsets of
+    // the match (slots 0 and 1) and of every group, -1 for groups that did not participate
+    int match(const std::string& str, int offset) {
+        if (!built || start == -1) return -1;
+        int matched = one_pass ? match_one_pass(str, offset) : match_pike(str, offset);
+        if (matched == -1) return -1;
+        best[0] = offset;
+        best[1] = matched;
+        return matched - offset;
+    }
+
+    // valid until the next match
+    const std::vector<int>& get_slots() {
+        return best;
+    }
+};
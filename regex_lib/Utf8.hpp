@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Node.hpp"
+
+#define MAX_CODE_POINT 0x10FFFF
+
+inline int utf8_length(int cp) {
+    if (cp <= 0x7F) return 1;
+    if (cp <= 0x7FF) return 2;
+    if (cp <= 0xFFFF) return 3;
+    return 4;
+}
+
+inline std::string utf8_encode(int cp) {
+    std::string res;
+    int len = utf8_length(cp);
+    if (len == 1) {
+        res.push_back((char)cp);
+        return res;
+    }
+    static const int first_byte_marks[] = {0, 0, 0xC0, 0xE0, 0xF0};
+    res.push_back((char)(first_byte_marks[len] | (cp >> (6 * (len - 1)))));
+    for (int i = len - 2; i >= 0; --i) res.push_back((char)(0x80 | ((cp >> (6 * i)) & 0x3F)));
+    return res;
+}
+
+// decodes the code point starting at pos, returns -1 for invalid sequences
+// (overlong encodings, surrogates and code points above MAX_CODE_POINT)
+inline int utf8_decode(const std::string& str, int pos, int& size) {
+    unsigned char c = str[pos];
+    size = 1;
+    if (c < 0x80) return c;
+    int len, cp;
+    if ((c & 0xE0) == 0xC0) { len = 2; cp = c & 0x1F; }
+    else if ((c & 0xF0) == 0xE0) { len = 3; cp = c & 0x0F; }
+    else if ((c & 0xF8) == 0xF0) { len = 4; cp = c & 0x07; }
+    else return -1;
+    if (pos + len > (int)str.size()) return -1;
+    for (int i = 1; i < len; ++i) {
+        unsigned char cont = str[pos + i];
+        if ((cont & 0xC0) != 0x80) return -1;
+        cp = (cp << 6) | (cont & 0x3F);
+    }
+    if (utf8_length(cp) != len || cp > MAX_CODE_POINT || (cp >= 0xD800 && cp <= 0xDFFF)) return -1;
+    size = len;
+    return cp;
+}
+
+// splits the code points range [lo, hi] into sequences of byte ranges, every code point
+// of the range is encoded by exactly one sequence, [0x80, 0x7FF] gives [C2-DF][80-BF] for example
+inline void utf8_sequences(int lo, int hi, std::vector<CharRanges>& res) {
+    if (lo > hi) return;
+    // surrogates have no encoding
+    if (lo <= 0xDFFF && hi >= 0xD800) {
+        utf8_sequences(lo, 0xD7FF, res);
+        utf8_sequences(0xE000, hi, res);
+        return;
+    }
+    // both ends must be encoded with the same number of bytes
+    static const int max_code_points[] = {0x7F, 0x7FF, 0xFFFF};
+    for (int m : max_code_points) {
+        if (lo <= m && hi > m) {
+            utf8_sequences(lo, m, res);
+            utf8_sequences(m + 1, hi, res);
+            return;
+        }
+    }
+    // the trailing bytes must cover full ranges so that each byte range is independent
+    int len = utf8_length(lo);
+    for (int i = 1; i < len; ++i) {
+        int m = (1 << (6 * i)) - 1;
+        if ((lo & ~m) == (hi & ~m)) continue;
+        if ((lo & m) != 0) {
+            utf8_sequences(lo, lo | m, res);
+            utf8_sequences((lo | m) + 1, hi, res);
+            return;
+        }
+        if ((hi & m) != m) {
+            utf8_sequences(lo, (hi & ~m) - 1, res);
+            utf8_sequences(hi & ~m, hi, res);
+            return;
+        }
+    }
+    std::string lo_bytes = utf8_encode(lo);
+    std::string hi_bytes = utf8_encode(hi);
+    CharRanges sequence;
+    for (int i = 0; i < len; ++i) sequence.push_back({(unsigned char)lo_bytes[i], (unsigned char)hi_bytes[i]});
+    res.push_back(sequence);
+}
+
+// code points that are not in the (normalized) ranges
+inline CharRanges complement_code_points(const CharRanges& ranges) {
+    CharRanges res;
+    int next = 0;
+    for (auto [lo, hi] : ranges) {
+        if (lo > next) res.push_back({next, lo - 1});
+        next = hi + 1;
+    }
+    if (next <= MAX_CODE_POINT) res.push_back({next, MAX_CODE_POINT});
+    return res;
+}